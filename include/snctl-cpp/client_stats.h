@@ -0,0 +1,487 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/logging.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A single-pass scanner of a JSON document that reports each scalar value with
+// the object keys leading to it, without building a document. Strings are
+// reported without their quotes and escape sequences are kept as they are.
+class StatsJsonScanner final {
+public:
+  static constexpr size_t max_depth = 8;
+  using Path = std::array<std::string_view, max_depth>;
+
+  // Call `on_value(path, depth, value)` for each scalar. Keys deeper than
+  // `max_depth` are not reported. Return false if the document is malformed.
+  template <typename OnValue>
+  static bool scan(std::string_view json, OnValue &&on_value) {
+    StatsJsonScanner scanner(json);
+    return scanner.parse_value(on_value);
+  }
+
+private:
+  const std::string_view json_;
+  size_t pos_ = 0;
+  Path path_{};
+  size_t depth_ = 0;
+
+  explicit StatsJsonScanner(std::string_view json) : json_(json) {}
+
+  static bool is_whitespace(char c) noexcept {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+  }
+
+  void skip_whitespace() noexcept {
+    while (pos_ < json_.size() && is_whitespace(json_[pos_])) {
+      pos_++;
+    }
+  }
+
+  bool consume(char c) noexcept {
+    skip_whitespace();
+    if (pos_ < json_.size() && json_[pos_] == c) {
+      pos_++;
+      return true;
+    }
+    return false;
+  }
+
+  bool parse_string(std::string_view &value) noexcept {
+    if (!consume('"')) {
+      return false;
+    }
+    const auto begin = pos_;
+    while (pos_ < json_.size() && json_[pos_] != '"') {
+      pos_ += json_[pos_] == '\\' ? 2 : 1;
+    }
+    if (pos_ >= json_.size()) {
+      return false;
+    }
+    value = json_.substr(begin, pos_ - begin);
+    pos_++;
+    return true;
+  }
+
+  template <typename OnValue> bool parse_value(OnValue &on_value) {
+    skip_whitespace();
+    if (pos_ >= json_.size()) {
+      return false;
+    }
+    switch (json_[pos_]) {
+    case '{':
+      return parse_container('}', on_value);
+    case '[':
+      return parse_container(']', on_value);
+    case '"': {
+      std::string_view value;
+      if (!parse_string(value)) {
+        return false;
+      }
+      report(on_value, value);
+      return true;
+    }
+    default: {
+      // A number, true, false or null
+      const auto begin = pos_;
+      while (pos_ < json_.size() && json_[pos_] != ',' && json_[pos_] != '}' &&
+             json_[pos_] != ']' && !is_whitespace(json_[pos_])) {
+        pos_++;
+      }
+      if (pos_ == begin) {
+        return false;
+      }
+      report(on_value, json_.substr(begin, pos_ - begin));
+      return true;
+    }
+    }
+  }
+
+  // Parse an object if `close` is '}', or an array, whose elements have an
+  // empty key
+  template <typename OnValue>
+  bool parse_container(char close, OnValue &on_value) {
+    pos_++;
+    if (consume(close)) {
+      return true;
+    }
+    const auto is_object = close == '}';
+    depth_++;
+    do {
+      std::string_view key;
+      if (is_object && (!parse_string(key) || !consume(':'))) {
+        return false;
+      }
+      if (depth_ <= max_depth) {
+        path_[depth_ - 1] = key;
+      }
+      if (!parse_value(on_value)) {
+        return false;
+      }
+    } while (consume(','));
+    depth_--;
+    return consume(close);
+  }
+
+  template <typename OnValue>
+  void report(OnValue &on_value, std::string_view value) {
+    if (depth_ <= max_depth) {
+      on_value(path_, depth_, value);
+    }
+  }
+};
+
+// The librdkafka statistics of the clients of a command, which are emitted
+// every `statistics.interval.ms` by each client's stats callback. Only a
+// curated set of metrics is kept: the request round-trip times, the producer's
+// internal queue latency, the batch sizes, the requests in flight and the
+// per-partition queues and consumer lag of the topic.
+class ClientStats final {
+public:
+  enum class Role { Producer, Consumer };
+
+  // A window of latencies in microseconds, or of batch sizes
+  struct Window {
+    int64_t avg = 0;
+    int64_t p99 = 0;
+    int64_t cnt = 0;
+  };
+
+  struct Broker {
+    std::string name;
+    int32_t nodeid = -1;
+    // Requests sent since the client started
+    int64_t tx = 0;
+    double request_rate = 0;
+    int64_t outbuf_cnt = 0;
+    int64_t waitresp_cnt = 0;
+    Window rtt;
+    Window int_latency;
+  };
+
+  struct Partition {
+    int64_t msgq_cnt = 0;
+    int64_t xmit_msgq_cnt = 0;
+    int64_t fetchq_cnt = 0;
+    int64_t fetchq_size = 0;
+    // -1 if unknown, e.g. if the partition is not consumed by the client
+    int64_t consumer_lag = -1;
+  };
+
+  struct Snapshot {
+    // Microseconds since an arbitrary point, used to compute rates
+    int64_t ts = 0;
+    // Messages in the producer queues
+    int64_t msg_cnt = 0;
+    Window batch_size;
+    Window batch_count;
+    // Keyed by the broker key of the stats
+    std::map<std::string, Broker, std::less<>> brokers;
+    std::map<int32_t, Partition> partitions;
+  };
+
+  // Parse the metrics of `topic`, return std::nullopt if the JSON is malformed
+  static std::optional<Snapshot> parse(std::string_view json,
+                                       std::string_view topic) {
+    Snapshot snapshot;
+    const auto ok = StatsJsonScanner::scan(
+        json, [&snapshot, topic](const StatsJsonScanner::Path &path,
+                                 size_t depth, std::string_view value) {
+          if (depth == 1) {
+            if (path[0] == "ts") {
+              snapshot.ts = to_int(value);
+            } else if (path[0] == "msg_cnt") {
+              snapshot.msg_cnt = to_int(value);
+            }
+          } else if (path[0] == "brokers" && depth >= 3) {
+            parse_broker(path, depth, value, snapshot);
+          } else if (path[0] == "topics" && depth >= 4 && path[1] == topic) {
+            parse_topic(path, depth, value, snapshot);
+          }
+        });
+    if (!ok) {
+      return std::nullopt;
+    }
+    return snapshot;
+  }
+
+  ClientStats(Role role, size_t clients, std::string topic)
+      : role_(role), topic_(std::move(topic)), clients_(clients) {}
+
+  ClientStats(const ClientStats &) = delete;
+  ClientStats &operator=(const ClientStats &) = delete;
+
+  // Called by the stats callback of a client
+  void update(size_t client_index, const char *json, size_t len) {
+    auto snapshot = parse(std::string_view(json, len), topic_);
+    if (!snapshot.has_value()) {
+      logging::err() << "Failed to parse the statistics of client "
+                     << client_index;
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    auto &previous = clients_[client_index];
+    if (previous.has_value() && snapshot->ts > previous->ts) {
+      const auto elapsed_s =
+          static_cast<double>(snapshot->ts - previous->ts) / 1e6;
+      for (auto &&[key, broker] : snapshot->brokers) {
+        if (auto it = previous->brokers.find(key);
+            it != previous->brokers.end() && broker.tx >= it->second.tx) {
+          broker.request_rate =
+              static_cast<double>(broker.tx - it->second.tx) / elapsed_s;
+        }
+      }
+    }
+    previous = std::move(snapshot);
+  }
+
+  // Print the latest metrics of all clients, merged by broker and partition
+  void report() const {
+    const auto merged = merge();
+    if (!merged.has_value()) {
+      return;
+    }
+    {
+      auto line = logging::out();
+      line << "librdkafka stats: ";
+      if (role_ == Role::Producer) {
+        line << "producer queue: " << merged->msg_cnt << " messages";
+        if (merged->batch_size.cnt > 0) {
+          line << ", batch avg: " << merged->batch_size.avg << " bytes, "
+               << merged->batch_count.avg << " messages";
+        }
+      }
+      report_partitions(line, merged->partitions);
+    }
+    for (auto &&[nodeid, broker] : merged_brokers(*merged)) {
+      auto line = logging::out();
+      line << "broker " << nodeid << " (" << broker.name
+           << "): rtt avg: " << to_ms(broker.rtt.avg)
+           << " ms, p99: " << to_ms(broker.rtt.p99) << " ms";
+      if (broker.int_latency.cnt > 0) {
+        line << ", internal queue latency avg: "
+             << to_ms(broker.int_latency.avg)
+             << " ms, p99: " << to_ms(broker.int_latency.p99) << " ms";
+      }
+      line << ", in flight: " << broker.waitresp_cnt
+           << ", waiting to send: " << broker.outbuf_cnt
+           << ", requests: " << broker.request_rate << "/s";
+    }
+  }
+
+private:
+  const Role role_;
+  const std::string topic_;
+  mutable std::mutex mu_;
+  // The latest snapshot of each client
+  std::vector<std::optional<Snapshot>> clients_;
+
+  static int64_t to_int(std::string_view value) noexcept {
+    int64_t number = 0;
+    std::from_chars(value.data(), value.data() + value.size(), number);
+    return number;
+  }
+
+  static double to_ms(int64_t us) noexcept {
+    return static_cast<double>(us) / 1000.0;
+  }
+
+  static void parse_window(std::string_view key, std::string_view value,
+                           Window &window) noexcept {
+    if (key == "avg") {
+      window.avg = to_int(value);
+    } else if (key == "p99") {
+      window.p99 = to_int(value);
+    } else if (key == "cnt") {
+      window.cnt = to_int(value);
+    }
+  }
+
+  // brokers.<key>.<field> or brokers.<key>.<window>.<field>
+  static void parse_broker(const StatsJsonScanner::Path &path, size_t depth,
+                           std::string_view value, Snapshot &snapshot) {
+    auto it = snapshot.brokers.find(path[1]);
+    if (it == snapshot.brokers.end()) {
+      it = snapshot.brokers.emplace(std::string(path[1]), Broker{}).first;
+    }
+    auto &broker = it->second;
+    if (depth == 3) {
+      if (path[2] == "name") {
+        broker.name = std::string(value);
+      } else if (path[2] == "nodeid") {
+        broker.nodeid = static_cast<int32_t>(to_int(value));
+      } else if (path[2] == "tx") {
+        broker.tx = to_int(value);
+      } else if (path[2] == "outbuf_cnt") {
+        broker.outbuf_cnt = to_int(value);
+      } else if (path[2] == "waitresp_cnt") {
+        broker.waitresp_cnt = to_int(value);
+      }
+    } else if (depth == 4) {
+      if (path[2] == "rtt") {
+        parse_window(path[3], value, broker.rtt);
+      } else if (path[2] == "int_latency") {
+        parse_window(path[3], value, broker.int_latency);
+      }
+    }
+  }
+
+  // topics.<topic>.<window>.<field> or topics.<topic>.partitions.<id>.<field>
+  static void parse_topic(const StatsJsonScanner::Path &path, size_t depth,
+                          std::string_view value, Snapshot &snapshot) {
+    if (depth == 4) {
+      if (path[2] == "batchsize") {
+        parse_window(path[3], value, snapshot.batch_size);
+      } else if (path[2] == "batchcnt") {
+        parse_window(path[3], value, snapshot.batch_count);
+      }
+      return;
+    }
+    if (depth != 5 || path[2] != "partitions") {
+      return;
+    }
+    const auto id = static_cast<int32_t>(to_int(path[3]));
+    // The internal partition of the messages without a partition yet
+    if (id < 0) {
+      return;
+    }
+    auto &partition = snapshot.partitions[id];
+    const auto key = path[4];
+    if (key == "msgq_cnt") {
+      partition.msgq_cnt = to_int(value);
+    } else if (key == "xmit_msgq_cnt") {
+      partition.xmit_msgq_cnt = to_int(value);
+    } else if (key == "fetchq_cnt") {
+      partition.fetchq_cnt = to_int(value);
+    } else if (key == "fetchq_size") {
+      partition.fetchq_size = to_int(value);
+    } else if (key == "consumer_lag") {
+      partition.consumer_lag = to_int(value);
+    }
+  }
+
+  static void merge_window(Window &total, const Window &window) noexcept {
+    if (window.cnt <= 0) {
+      return;
+    }
+    total.avg = (total.avg * total.cnt + window.avg * window.cnt) /
+                (total.cnt + window.cnt);
+    total.cnt += window.cnt;
+    total.p99 = std::max(total.p99, window.p99);
+  }
+
+  // Merge the snapshots of all clients, whose brokers are keyed by the broker
+  // key of the first client that reports them
+  std::optional<Snapshot> merge() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::optional<Snapshot> merged;
+    for (auto &&client : clients_) {
+      if (!client.has_value()) {
+        continue;
+      }
+      if (!merged.has_value()) {
+        merged.emplace();
+      }
+      merged->msg_cnt += client->msg_cnt;
+      merge_window(merged->batch_size, client->batch_size);
+      merge_window(merged->batch_count, client->batch_count);
+      for (auto &&[key, broker] : client->brokers) {
+        auto &total = merged->brokers[key];
+        total.name = broker.name;
+        total.nodeid = broker.nodeid;
+        total.tx += broker.tx;
+        total.request_rate += broker.request_rate;
+        total.outbuf_cnt += broker.outbuf_cnt;
+        total.waitresp_cnt += broker.waitresp_cnt;
+        merge_window(total.rtt, broker.rtt);
+        merge_window(total.int_latency, broker.int_latency);
+      }
+      for (auto &&[id, partition] : client->partitions) {
+        auto &total = merged->partitions[id];
+        total.msgq_cnt += partition.msgq_cnt;
+        total.xmit_msgq_cnt += partition.xmit_msgq_cnt;
+        total.fetchq_cnt += partition.fetchq_cnt;
+        total.fetchq_size += partition.fetchq_size;
+        total.consumer_lag =
+            std::max(total.consumer_lag, partition.consumer_lag);
+      }
+    }
+    return merged;
+  }
+
+  // The brokers that are known by their node id, which excludes the
+  // bootstrap brokers and the logical group coordinator
+  static std::map<int32_t, Broker> merged_brokers(const Snapshot &snapshot) {
+    std::map<int32_t, Broker> brokers;
+    for (auto &&[key, broker] : snapshot.brokers) {
+      if (broker.nodeid >= 0 && broker.name.find("Coordinator") ==
+                                    std::string::npos) {
+        brokers.emplace(broker.nodeid, broker);
+      }
+    }
+    return brokers;
+  }
+
+  void report_partitions(logging::Line &line,
+                         const std::map<int32_t, Partition> &partitions) const {
+    int64_t queued = 0;
+    int64_t queued_bytes = 0;
+    std::optional<std::pair<int32_t, int64_t>> max_queued;
+    std::optional<std::pair<int32_t, int64_t>> max_lag;
+    for (auto &&[id, partition] : partitions) {
+      const auto partition_queued =
+          role_ == Role::Producer
+              ? partition.msgq_cnt + partition.xmit_msgq_cnt
+              : partition.fetchq_cnt;
+      queued += partition_queued;
+      queued_bytes += partition.fetchq_size;
+      if (partition_queued > 0 &&
+          (!max_queued.has_value() || partition_queued > max_queued->second)) {
+        max_queued = std::make_pair(id, partition_queued);
+      }
+      if (partition.consumer_lag >= 0 &&
+          (!max_lag.has_value() || partition.consumer_lag > max_lag->second)) {
+        max_lag = std::make_pair(id, partition.consumer_lag);
+      }
+    }
+    if (role_ == Role::Producer) {
+      line << ", partition queues: " << queued << " messages";
+    } else {
+      line << "fetch queues: " << queued << " messages (" << queued_bytes
+           << " bytes)";
+    }
+    if (max_queued.has_value()) {
+      line << ", fullest: partition " << max_queued->first << " ("
+           << max_queued->second << " messages)";
+    }
+    if (max_lag.has_value()) {
+      line << ", max lag: " << max_lag->second << " (partition "
+           << max_lag->first << ")";
+    }
+  }
+};
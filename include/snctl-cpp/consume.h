@@ -15,17 +15,35 @@
  */
 #pragma once
 
+#include "snctl-cpp/client_stats.h"
+#include "snctl-cpp/consume/batch_reader.h"
+#include "snctl-cpp/consume/consume_bounds.h"
+#include "snctl-cpp/consume/debug_printer.h"
+#include "snctl-cpp/consume/message_sink.h"
+#include "snctl-cpp/consume/offset_committer.h"
+#include "snctl-cpp/consume/partition_stats.h"
+#include "snctl-cpp/consume/rebalance_summary.h"
+#include "snctl-cpp/consume/sequence_verifier.h"
+#include "snctl-cpp/consume/static_assignment.h"
+#include "snctl-cpp/consume/worker_pool.h"
 #include "snctl-cpp/kafka_client.h"
+#include "snctl-cpp/kafka_conf_template.h"
+#include "snctl-cpp/latency_histogram.h"
 #include "snctl-cpp/logging.h"
+#include "snctl-cpp/message_header.h"
+#include "snctl-cpp/metrics_emitter.h"
 #include "snctl-cpp/raii_helper.h"
+#include "snctl-cpp/sharded_counters.h"
 #include "snctl-cpp/stop_signal.h"
 
+#include <algorithm>
 #include <argparse/argparse.hpp>
 #include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <ctime>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <sstream>
@@ -35,6 +53,29 @@
 #include <unordered_map>
 #include <vector>
 
+enum class ConsumeCounter {
+  ConsumedMessages,
+  ConsumedBytes,
+  PollErrors,
+  // Calls that returned at least one message
+  Batches,
+  // The counters below are only updated by --commit-mode sync or async
+  Commits,
+  CommitFailures,
+  CommitRetries,
+  // The counters below are only updated by --verify
+  Gaps,
+  LateMessages,
+  DuplicateMessages,
+  ReorderedMessages,
+  // Messages without the header written by `produce`
+  UnverifiedMessages,
+  Count
+};
+
+// One shard per consumer thread
+using ConsumeCounters = ShardedCounters<ConsumeCounter>;
+
 class ConsumeCommand final {
 public:
   explicit ConsumeCommand(argparse::ArgumentParser &parent) {
@@ -48,14 +89,115 @@ public:
     command_.add_argument("--offset-reset")
         .help("Offset reset policy for new groups: earliest or latest")
         .default_value(std::string("earliest"));
+    command_.add_argument("--assign-mode")
+        .help("How partitions are assigned: group (subscribe and join the "
+              "consumer group) or static (split --partitions across the "
+              "consumers with rd_kafka_assign)")
+        .default_value(std::string("group"));
+    command_.add_argument("--partitions")
+        .help("With --assign-mode static, the partitions to consume like 0-15 "
+              "or 0,2,4-7. Defaults to all partitions");
+    command_.add_argument("--from-timestamp")
+        .help("Start from the first message at or after this time, in "
+              "milliseconds since the epoch or relative like -2h, -30m, -90s");
+    command_.add_argument("--to-timestamp")
+        .help("Stop each partition before its first message at or after this "
+              "time, in the same format as --from-timestamp");
+    command_.add_argument("--until-end")
+        .default_value(false)
+        .implicit_value(true)
+        .help("Stop once every partition reaches the end offset queried at "
+              "the start");
+    command_.add_argument("--max-messages")
+        .help("Stop after consuming N messages in total, 0 means no limit")
+        .scan<'i', int64_t>()
+        .default_value(int64_t{0});
+    command_.add_argument("--commit-mode")
+        .help("How offsets are committed: auto (enable.auto.commit), sync "
+              "(rd_kafka_commit) or async (rd_kafka_commit_queue)")
+        .default_value(std::string("auto"));
+    command_.add_argument("--commit-every")
+        .help("Commit every N messages, or every T milliseconds or seconds "
+              "like 500ms or 5s (only a time in auto mode). Defaults to 5s");
+    command_.add_argument("--batch-size")
+        .help("Read up to N messages per rd_kafka_consume_batch_queue() call, "
+              "0 means one rd_kafka_consumer_poll() call per message")
+        .scan<'i', int>()
+        .default_value(0);
+    command_.add_argument("--partition-queues")
+        .default_value(false)
+        .implicit_value(true)
+        .help("In batch mode, read from the queue of each assigned partition "
+              "instead of the consumer queue");
+    command_.add_argument("--workers")
+        .help("Process the messages on a pool of N worker threads, 0 means the "
+              "consumer threads only count them")
+        .scan<'i', int>()
+        .default_value(0);
+    command_.add_argument("--process-us")
+        .help("Simulated processing time per message: <us>, exp:<mean us> or "
+              "uniform:<min us>-<max us>")
+        .default_value(std::string("0"));
+    command_.add_argument("--order-by")
+        .help("Process the messages of the same key or partition in order")
+        .default_value(std::string("key"));
+    command_.add_argument("--worker-queue")
+        .help("Maximum number of messages queued for the workers, after which "
+              "consumers wait")
+        .scan<'i', int>()
+        .default_value(10000);
+    command_.add_argument("--verify")
+        .default_value(false)
+        .implicit_value(true)
+        .help("Verify the sequences written by `produce` and report gaps, "
+              "duplicates and out-of-order messages");
+    command_.add_argument("--top-partitions")
+        .help("Number of the hottest partitions whose rate and lag are "
+              "reported every interval, 0 means none")
+        .scan<'i', int>()
+        .default_value(5);
+    command_.add_argument("--output")
+        .help("Export the consumed messages to a file, or to the standard "
+              "output if it's \"-\"");
+    command_.add_argument("--output-format")
+        .help("Framing of the exported messages: raw (value and newline), "
+              "binary (length-prefixed key and value) or json (a line per "
+              "message with its metadata)")
+        .default_value(std::string("raw"));
+    command_.add_argument("--output-segment-mb")
+        .help("Roll the output file over to <output>.<index> files of up to N "
+              "MiB, 0 means a single file")
+        .scan<'i', int>()
+        .default_value(0);
     command_.add_argument("--report-interval-ms")
         .help("Stats report interval in milliseconds")
         .scan<'i', int>()
         .default_value(1000);
+    command_.add_argument("--client-stats")
+        .default_value(false)
+        .implicit_value(true)
+        .help("Report librdkafka's statistics every interval, e.g. the broker "
+              "round-trip times, the fetch queues and the consumer lag");
+    command_.add_argument("--metrics-file")
+        .help("Also write the stats of every interval to a file in the "
+              "--metrics-format format");
+    command_.add_argument("--metrics-format")
+        .help("Format of --metrics-file: json (an object per line), csv or "
+              "prometheus (a textfile-collector file replaced every interval)")
+        .default_value(std::string("json"));
     command_.add_argument("--debug")
         .default_value(false)
         .implicit_value(true)
-        .help("Print each consumed message's metadata");
+        .help("Print the metadata of the consumed messages");
+    command_.add_argument("--debug-sample")
+        .help("With --debug, print every N-th message of each consumer")
+        .scan<'i', int>()
+        .default_value(1);
+    command_.add_argument("--debug-max-rate")
+        .help("With --debug, print at most N messages per second, 0 means no "
+              "limit")
+        .scan<'g', double>()
+        .default_value(0.0);
 
     parent.add_subparser(command_);
   }
@@ -70,8 +212,39 @@ public:
     const auto topic = command_.get("topic");
     const auto consumer_count = command_.get<int>("--consumers");
     const auto offset_reset = command_.get("--offset-reset");
+    const auto assign_mode =
+        StaticAssignment::parse_mode(command_.get("--assign-mode"));
+    const auto partitions_spec = command_.present("--partitions");
     const auto report_interval_ms = command_.get<int>("--report-interval-ms");
+    const auto client_stats_enabled = command_.get<bool>("--client-stats");
+    const auto metrics_file = command_.present("--metrics-file");
+    const auto metrics_format =
+        MetricsEmitter::parse_format(command_.get("--metrics-format"));
     const auto debug = command_.get<bool>("debug");
+    const auto debug_sample = command_.get<int>("--debug-sample");
+    const auto debug_max_rate = command_.get<double>("--debug-max-rate");
+    const auto batch_size = command_.get<int>("--batch-size");
+    const auto partition_queues = command_.get<bool>("--partition-queues");
+    const auto verify = command_.get<bool>("--verify");
+    const auto top_partitions = command_.get<int>("--top-partitions");
+    const auto commit_mode =
+        OffsetCommitter::parse_mode(command_.get("--commit-mode"));
+    const auto commit_cadence = OffsetCommitter::parse_cadence(
+        command_.present("--commit-every").value_or("5s"));
+    const auto worker_count = command_.get<int>("--workers");
+    const auto processing_cost =
+        ProcessingCost::parse(command_.get("--process-us"));
+    const auto order_by =
+        WorkerPool::parse_order_by(command_.get("--order-by"));
+    const auto worker_queue = command_.get<int>("--worker-queue");
+    const auto from_timestamp = command_.present("--from-timestamp");
+    const auto to_timestamp = command_.present("--to-timestamp");
+    const auto until_end = command_.get<bool>("--until-end");
+    const auto max_messages = command_.get<int64_t>("--max-messages");
+    const auto output = command_.present("--output");
+    const auto output_format =
+        MessageSink::parse_format(command_.get("--output-format"));
+    const auto output_segment_mb = command_.get<int>("--output-segment-mb");
 
     if (consumer_count <= 0) {
       throw std::invalid_argument(
@@ -81,23 +254,183 @@ public:
       throw std::invalid_argument(
           "The offset reset policy must be either earliest or latest");
     }
+    if (partitions_spec.has_value() &&
+        assign_mode != StaticAssignment::Mode::Static) {
+      throw std::invalid_argument("--partitions requires --assign-mode static");
+    }
+    // Without a group, there are no committed offsets to start from or commit
+    const auto use_group = assign_mode == StaticAssignment::Mode::Group ||
+                           command_.present("--group").has_value();
+    if (!use_group && commit_mode != OffsetCommitter::Mode::Auto) {
+      throw std::invalid_argument(
+          "--commit-mode sync or async with --assign-mode static requires "
+          "--group");
+    }
+    if (batch_size < 0) {
+      throw std::invalid_argument("The batch size must not be negative");
+    }
+    if (partition_queues && batch_size == 0) {
+      throw std::invalid_argument("--partition-queues requires --batch-size");
+    }
+    if (top_partitions < 0) {
+      throw std::invalid_argument(
+          "The number of top partitions must not be negative");
+    }
     if (report_interval_ms <= 0) {
       throw std::invalid_argument(
           "The report interval must be greater than 0 milliseconds");
     }
+    if (commit_mode == OffsetCommitter::Mode::Auto &&
+        commit_cadence.messages > 0) {
+      throw std::invalid_argument(
+          "Auto commits can only be configured with an interval");
+    }
+    if (worker_count < 0) {
+      throw std::invalid_argument("The number of workers must not be negative");
+    }
+    if (worker_queue <= 0) {
+      throw std::invalid_argument(
+          "The worker queue size must be greater than 0");
+    }
+    if (worker_count == 0 && !processing_cost.is_zero()) {
+      throw std::invalid_argument("--process-us requires --workers");
+    }
+    if (debug_sample <= 0) {
+      throw std::invalid_argument("The debug sample must be greater than 0");
+    }
+    if (debug_max_rate < 0) {
+      throw std::invalid_argument("The debug rate cap must not be negative");
+    }
+    if (max_messages < 0) {
+      throw std::invalid_argument(
+          "The maximum number of messages must not be negative");
+    }
+    const auto from_timestamp_ms =
+        from_timestamp.has_value()
+            ? std::make_optional(parse_timestamp_ms(*from_timestamp))
+            : std::nullopt;
+    const auto to_timestamp_ms =
+        to_timestamp.has_value()
+            ? std::make_optional(parse_timestamp_ms(*to_timestamp))
+            : std::nullopt;
+    if (from_timestamp_ms.has_value() && to_timestamp_ms.has_value() &&
+        *to_timestamp_ms <= *from_timestamp_ms) {
+      throw std::invalid_argument(
+          "--to-timestamp must be later than --from-timestamp");
+    }
+    if (output_segment_mb < 0) {
+      throw std::invalid_argument("The output segment size must not be "
+                                  "negative");
+    }
+    if (output == "-") {
+      logging::stdout_reserved() = true;
+    }
 
     const auto group_id =
         command_.present("--group").value_or(default_group_id(topic));
 
-    logging::out() << "Started " << consumer_count << " consumer"
-                   << (consumer_count == 1 ? "" : "s") << " on topic \""
-                   << topic << "\" in group \"" << group_id
-                   << "\". Press Ctrl+C to stop.";
+    // A client outside the group that queries the metadata and the high
+    // watermarks for the per-partition stats
+    auto reporter_configs = base_configs;
+    reporter_configs["client.id"] =
+        (client_id_base.has_value() && !client_id_base->empty()
+             ? *client_id_base
+             : group_id) +
+        "-reporter";
+    KafkaClient reporter_client(RD_KAFKA_CONSUMER, reporter_configs,
+                                log_configs);
+    // Partitions created after the start are not counted
+    const auto partitions = static_cast<size_t>(
+        partition_count(reporter_client.rk(), topic, 10000));
+    std::optional<StaticAssignment> static_assignment;
+    if (assign_mode == StaticAssignment::Mode::Static) {
+      static_assignment.emplace(StaticAssignment::parse_partitions(
+                                    partitions_spec.value_or(""), partitions),
+                                static_cast<size_t>(consumer_count));
+    }
+    ConsumeBounds bounds(partitions, static_cast<uint64_t>(max_messages));
+    if (static_assignment.has_value()) {
+      bounds.restrict_to(static_assignment->partitions());
+    }
+    if (from_timestamp_ms.has_value()) {
+      bounds.set_start_offsets(offsets_for_timestamp(
+          reporter_client.rk(), topic, partitions, *from_timestamp_ms, 10000));
+    }
+    if (until_end || to_timestamp_ms.has_value()) {
+      const auto end_offsets = query_end_offsets(reporter_client.rk(), topic,
+                                                 partitions);
+      if (until_end) {
+        bounds.set_stop_offsets(end_offsets);
+      }
+      if (to_timestamp_ms.has_value()) {
+        auto stop_offsets = offsets_for_timestamp(
+            reporter_client.rk(), topic, partitions, *to_timestamp_ms, 10000);
+        for (size_t i = 0; i < partitions; i++) {
+          // No message at or after the timestamp yet
+          if (stop_offsets[i] == RD_KAFKA_OFFSET_END) {
+            stop_offsets[i] = end_offsets[i];
+          }
+        }
+        bounds.set_stop_offsets(stop_offsets);
+      }
+    }
+
+    {
+      auto line = logging::out();
+      line << "Started " << consumer_count << " consumer"
+           << (consumer_count == 1 ? "" : "s") << " on topic \"" << topic
+           << "\"";
+      if (static_assignment.has_value()) {
+        line << " with a static assignment of " << static_assignment->size()
+             << " partitions";
+      }
+      if (use_group) {
+        line << " in group \"" << group_id << "\"";
+      }
+      line << ". Press Ctrl+C to stop.";
+    }
 
     StopSignalGuard stop_signal_guard;
-    std::atomic<uint64_t> consumed_messages = 0;
-    std::atomic<uint64_t> consumed_bytes = 0;
-    std::atomic<uint64_t> poll_errors = 0;
+    const auto start_time = std::chrono::steady_clock::now();
+    // Nanoseconds since `start_time`, 0 until the first message is consumed
+    std::atomic<int64_t> first_message_ns{0};
+    ConsumeCounters counters(static_cast<size_t>(consumer_count));
+    // Each consumer records end-to-end latencies into its own recorder, which
+    // are merged by the reporter
+    std::vector<std::unique_ptr<LatencyRecorder>> latency_recorders;
+    // Only recorded with --commit-mode sync or async
+    std::vector<std::unique_ptr<LatencyRecorder>> commit_latency_recorders;
+    SequenceVerifier verifier;
+    std::vector<std::unique_ptr<PartitionCounters>> partition_counters;
+    RebalanceSummary rebalance_summary(static_cast<size_t>(consumer_count));
+    std::optional<ClientStats> client_stats;
+    if (client_stats_enabled) {
+      client_stats.emplace(ClientStats::Role::Consumer,
+                           static_cast<size_t>(consumer_count), topic);
+    }
+    std::optional<WorkerPool> worker_pool;
+    if (worker_count > 0) {
+      worker_pool.emplace(static_cast<size_t>(worker_count), order_by,
+                          processing_cost, static_cast<size_t>(worker_queue));
+    }
+    std::optional<DebugPrinter> debug_printer;
+    if (debug) {
+      debug_printer.emplace(topic, static_cast<uint64_t>(debug_sample),
+                            debug_max_rate,
+                            static_cast<size_t>(consumer_count));
+    }
+    std::optional<MetricsEmitter> metrics;
+    if (metrics_file.has_value()) {
+      metrics.emplace(*metrics_file, metrics_format, "consume", topic);
+    }
+    std::optional<MessageSink> sink;
+    if (output.has_value()) {
+      sink.emplace(*output, output_format,
+                   static_cast<uint64_t>(output_segment_mb) * 1024 * 1024);
+    }
+    // The final assignment of each consumer
+    std::mutex assignments_mu;
+    std::vector<std::vector<int32_t>> assignments(consumer_count);
     std::vector<std::thread> threads;
     std::mutex errors_mu;
     std::mutex output_mu;
@@ -108,20 +441,63 @@ public:
       errors.emplace_back(std::move(message));
     };
 
+    latency_recorders.reserve(consumer_count);
+    partition_counters.reserve(consumer_count);
+    for (int i = 0; i < consumer_count; i++) {
+      latency_recorders.emplace_back(std::make_unique<LatencyRecorder>());
+      commit_latency_recorders.emplace_back(
+          std::make_unique<LatencyRecorder>());
+      partition_counters.emplace_back(
+          std::make_unique<PartitionCounters>(partitions));
+    }
+    // The configs shared by all consumers, which are validated once here
+    auto consumer_configs = base_configs;
+    if (use_group) {
+      consumer_configs["group.id"] = group_id;
+    }
+    consumer_configs["auto.offset.reset"] = offset_reset;
+    if (commit_mode != OffsetCommitter::Mode::Auto || !use_group) {
+      consumer_configs["enable.auto.commit"] = "false";
+    } else if (commit_cadence.interval.count() > 0) {
+      consumer_configs["auto.commit.interval.ms"] =
+          std::to_string(commit_cadence.interval.count());
+    }
+    if (client_stats.has_value()) {
+      consumer_configs["statistics.interval.ms"] =
+          std::to_string(report_interval_ms);
+    }
+    if (bounds.has_stop_offsets()) {
+      // Partitions may end with offsets that are never delivered, e.g.
+      // transaction markers
+      consumer_configs["enable.partition.eof"] = "true";
+    }
+    const KafkaConfTemplate conf_template(consumer_configs);
+
     threads.reserve(consumer_count);
     for (int i = 0; i < consumer_count; i++) {
       threads.emplace_back([&, consumer_index = i]() {
         try {
-          auto client_configs = base_configs;
-          client_configs["group.id"] = group_id;
-          client_configs["client.id"] =
-              make_client_id(client_id_base, group_id, consumer_index);
-          client_configs["auto.offset.reset"] = offset_reset;
+          const KafkaConfTemplate::Properties client_configs{
+              {"client.id",
+               make_client_id(client_id_base, group_id, consumer_index)}};
+          // It must outlive the client, whose rebalance callback uses it
+          std::optional<BatchReader> batch_reader;
+          if (batch_size > 0) {
+            batch_reader.emplace(static_cast<size_t>(batch_size),
+                                 partition_queues);
+          }
+          // The queue receives the results of async commits
           KafkaClient client(
-              RD_KAFKA_CONSUMER, client_configs, log_configs, false,
-              [&output_mu, consumer_index](
+              RD_KAFKA_CONSUMER, conf_template, client_configs, log_configs,
+              commit_mode == OffsetCommitter::Mode::Async,
+              [&output_mu, &batch_reader, &rebalance_summary, consumer_index](
                   rd_kafka_t *rk, rd_kafka_resp_err_t err,
-                  const rd_kafka_topic_partition_list_t *partitions) {
+                  const rd_kafka_topic_partition_list_t *partitions,
+                  const KafkaClient::RebalanceEvent &event) {
+                if (batch_reader.has_value()) {
+                  batch_reader->on_rebalance(rk, err, partitions);
+                }
+                rebalance_summary.add(consumer_index, event);
                 std::lock_guard<std::mutex> lock(output_mu);
                 if (err == RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS ||
                     err == RD_KAFKA_RESP_ERR__REVOKE_PARTITIONS) {
@@ -130,58 +506,245 @@ public:
                       << rebalance_action(err)
                       << " partitions: " << format_partitions(partitions)
                       << " (current assignment: " << current_assignment(rk)
-                      << ")";
+                      << "; " << RebalanceSummary::describe(event) << ")";
                   return;
                 }
                 logging::err()
                     << "consumer[" << consumer_index
                     << "] rebalance error: " << rd_kafka_err2str(err)
                     << " (current assignment: " << current_assignment(rk)
-                    << ")";
-              });
-
-          auto *subscription = rd_kafka_topic_partition_list_new(1);
-          if (subscription == nullptr) {
-            throw std::runtime_error("consumer[" +
-                                     std::to_string(consumer_index) +
-                                     "] failed to create subscription list");
+                    << "; " << RebalanceSummary::describe(event) << ")";
+              },
+              {},
+              client_stats.has_value()
+                  ? KafkaClient::StatsCallback(
+                        [&client_stats, consumer_index](const char *json,
+                                                        size_t len) {
+                          client_stats->update(
+                              static_cast<size_t>(consumer_index), json, len);
+                        })
+                  : KafkaClient::StatsCallback());
+          if (from_timestamp_ms.has_value()) {
+            client.set_assign_callback(
+                [&bounds](rd_kafka_topic_partition_list_t *partitions) {
+                  bounds.apply_start_offsets(partitions);
+                });
           }
-          GUARD(subscription, rd_kafka_topic_partition_list_destroy);
-          rd_kafka_topic_partition_list_add(subscription, topic.c_str(),
-                                            RD_KAFKA_PARTITION_UA);
-
-          const auto subscribe_err =
-              rd_kafka_subscribe(client.rk(), subscription);
-          if (subscribe_err != RD_KAFKA_RESP_ERR_NO_ERROR) {
-            throw std::runtime_error(
-                "consumer[" + std::to_string(consumer_index) +
-                "] failed to subscribe: " + rd_kafka_err2str(subscribe_err));
+          // Release the reader's queues before the client is destroyed
+          auto *attached_reader =
+              batch_reader.has_value() ? &*batch_reader : nullptr;
+          if (attached_reader != nullptr) {
+            attached_reader->attach(client.rk());
           }
+          GUARD(attached_reader, detach_batch_reader);
 
-          while (!StopSignalGuard::is_stop_requested()) {
-            auto *message = rd_kafka_consumer_poll(client.rk(), 250);
-            if (message == nullptr) {
-              continue;
+          if (static_assignment.has_value()) {
+            int64_t initial_offset = RD_KAFKA_OFFSET_STORED;
+            if (!use_group) {
+              initial_offset = offset_reset == "earliest"
+                                   ? RD_KAFKA_OFFSET_BEGINNING
+                                   : RD_KAFKA_OFFSET_END;
+            }
+            auto *assignment = static_assignment->make_list(
+                topic, static_cast<size_t>(consumer_index), initial_offset);
+            GUARD(assignment, rd_kafka_topic_partition_list_destroy);
+            bounds.apply_start_offsets(assignment);
+            const auto assign_err = rd_kafka_assign(client.rk(), assignment);
+            if (assign_err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+              throw std::runtime_error(
+                  "consumer[" + std::to_string(consumer_index) +
+                  "] failed to assign partitions: " +
+                  rd_kafka_err2str(assign_err));
+            }
+            if (batch_reader.has_value()) {
+              batch_reader->on_rebalance(client.rk(),
+                                         RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS,
+                                         assignment);
+            }
+            std::lock_guard<std::mutex> lock(output_mu);
+            logging::out() << "consumer[" << consumer_index
+                           << "] assigned partitions: "
+                           << format_partitions(assignment);
+          } else {
+            auto *subscription = rd_kafka_topic_partition_list_new(1);
+            if (subscription == nullptr) {
+              throw std::runtime_error("consumer[" +
+                                       std::to_string(consumer_index) +
+                                       "] failed to create subscription list");
+            }
+            GUARD(subscription, rd_kafka_topic_partition_list_destroy);
+            rd_kafka_topic_partition_list_add(subscription, topic.c_str(),
+                                              RD_KAFKA_PARTITION_UA);
+
+            const auto subscribe_err =
+                rd_kafka_subscribe(client.rk(), subscription);
+            if (subscribe_err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+              throw std::runtime_error(
+                  "consumer[" + std::to_string(consumer_index) +
+                  "] failed to subscribe: " + rd_kafka_err2str(subscribe_err));
             }
+          }
+
+          auto &stats = counters.shard(consumer_index);
+          auto &latency_recorder = *latency_recorders[consumer_index];
+          auto &partition_stats = *partition_counters[consumer_index];
+          OffsetCommitter committer(client.rk(), client.queue(), commit_mode,
+                                    commit_cadence,
+                                    *commit_latency_recorders[consumer_index]);
+          auto add_commit_stats = [&stats, &committer]() {
+            const auto result = committer.take_result();
+            stats.add(ConsumeCounter::Commits, result.commits);
+            stats.add(ConsumeCounter::CommitFailures, result.failures);
+            stats.add(ConsumeCounter::CommitRetries, result.retries);
+          };
+          std::optional<WorkerPool::Submitter> submitter;
+          if (worker_pool.has_value()) {
+            submitter.emplace(*worker_pool);
+          }
+          std::optional<DebugPrinter::Sampler> debug_sampler;
+          if (debug_printer.has_value()) {
+            debug_sampler.emplace(*debug_printer, consumer_index);
+          }
+          std::optional<MessageSink::Writer> sink_writer;
+          if (sink.has_value()) {
+            sink_writer.emplace(*sink);
+          }
+          std::optional<SequenceChecker> checker;
+          if (verify) {
+            checker.emplace(verifier);
+          }
+          auto add_verify_stats = [&stats, &checker]() {
+            const auto result = checker->take_result();
+            stats.add(ConsumeCounter::Gaps, result.gaps);
+            stats.add(ConsumeCounter::LateMessages, result.late);
+            stats.add(ConsumeCounter::DuplicateMessages, result.duplicates);
+            stats.add(ConsumeCounter::ReorderedMessages, result.reordered);
+          };
 
+          // Counted locally and added to the shard once per batch
+          uint64_t consumed = 0;
+          uint64_t consumed_bytes = 0;
+          uint64_t poll_errors = 0;
+          uint64_t unverified = 0;
+          auto handle_message = [&](const rd_kafka_message_t *message) {
             if (message->err == RD_KAFKA_RESP_ERR_NO_ERROR) {
-              consumed_messages++;
+              bool reached_stop = false;
+              const auto accepted = bounds.accept(
+                  message->partition, message->offset, reached_stop);
+              if (reached_stop) {
+                pause_partition(client.rk(), message);
+              }
+              if (!accepted) {
+                return;
+              }
+              if (first_message_ns.load(std::memory_order_relaxed) == 0) {
+                int64_t expected = 0;
+                first_message_ns.compare_exchange_strong(
+                    expected,
+                    std::max<int64_t>(
+                        1, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start_time)
+                               .count()));
+              }
+              consumed++;
               consumed_bytes += static_cast<uint64_t>(message->len);
-              if (debug) {
-                std::lock_guard<std::mutex> lock(output_mu);
-                logging::out() << "consumer[" << consumer_index
-                               << "] message topic=" << message_topic(message)
-                               << " partition=" << message->partition
-                               << " offset=" << message->offset
-                               << " timestamp=" << message_timestamp(message);
+              partition_stats.add(message->partition,
+                                  static_cast<uint64_t>(message->len),
+                                  message->offset);
+              const auto header =
+                  MessageHeader::parse(message->payload, message->len);
+              if (header.has_value() && header->timestamp_us != 0) {
+                // Clock skew between hosts can lead to negative latencies
+                const auto latency_us = std::max<int64_t>(
+                    0, MessageHeader::now_us() - header->timestamp_us);
+                latency_recorder.record(static_cast<uint64_t>(latency_us));
+              }
+              if (sink_writer.has_value()) {
+                sink_writer->write(message);
               }
-            } else if (message->err != RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+              if (checker.has_value()) {
+                if (header.has_value()) {
+                  checker->check(header->producer_index, message->partition,
+                                 header->sequence);
+                } else {
+                  unverified++;
+                }
+              }
+              if (debug_sampler.has_value()) {
+                debug_sampler->record(message);
+              }
+              if (submitter.has_value()) {
+                submitter->add(message);
+              }
+            } else if (message->err == RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+              bounds.on_partition_eof(message->partition, message->offset);
+            } else {
               std::lock_guard<std::mutex> lock(output_mu);
               logging::err() << "consumer[" << consumer_index
                              << "] error: " << rd_kafka_message_errstr(message);
               poll_errors++;
             }
-            rd_kafka_message_destroy(message);
+          };
+
+          const auto watermark_refresh_interval =
+              std::chrono::milliseconds(report_interval_ms);
+          auto next_watermark_refresh = std::chrono::steady_clock::now();
+          while (!StopSignalGuard::is_stop_requested()) {
+            uint64_t batches = 0;
+            if (batch_reader.has_value()) {
+              batches = batch_reader->read(250, handle_message);
+            } else if (auto *message = rd_kafka_consumer_poll(client.rk(), 250);
+                       message != nullptr) {
+              handle_message(message);
+              rd_kafka_message_destroy(message);
+              batches = 1;
+            }
+            if (checker.has_value()) {
+              checker->flush();
+              add_verify_stats();
+            }
+            if (sink_writer.has_value()) {
+              sink_writer->flush_if_stale();
+            }
+            if (submitter.has_value()) {
+              submitter->flush();
+            }
+            if (bounds.finished()) {
+              StopSignalGuard::request_stop();
+            }
+            committer.poll();
+            committer.on_consumed(consumed);
+            add_commit_stats();
+            if (const auto now = std::chrono::steady_clock::now();
+                now >= next_watermark_refresh) {
+              partition_stats.refresh_high_watermarks(client.rk(), topic);
+              next_watermark_refresh = now + watermark_refresh_interval;
+            }
+            if (batches == 0) {
+              continue;
+            }
+            stats.add(ConsumeCounter::Batches, batches);
+            stats.add(ConsumeCounter::ConsumedMessages, consumed);
+            stats.add(ConsumeCounter::ConsumedBytes, consumed_bytes);
+            stats.add(ConsumeCounter::PollErrors, poll_errors);
+            stats.add(ConsumeCounter::UnverifiedMessages, unverified);
+            consumed = consumed_bytes = poll_errors = unverified = 0;
+          }
+          if (checker.has_value()) {
+            checker->flush(true);
+            add_verify_stats();
+          }
+          if (sink_writer.has_value()) {
+            sink_writer->flush();
+          }
+          committer.finish(10000);
+          add_commit_stats();
+          partition_stats.refresh_high_watermarks(client.rk(), topic);
+
+          {
+            auto assignment = assigned_partitions(client.rk(), topic);
+            std::lock_guard<std::mutex> lock(assignments_mu);
+            assignments[consumer_index] = std::move(assignment);
           }
 
           const auto close_err = rd_kafka_consumer_close(client.rk());
@@ -198,24 +761,164 @@ public:
     }
 
     const auto report_interval = std::chrono::milliseconds(report_interval_ms);
-    uint64_t previous_consumed = 0;
+    auto previous = counters.snapshot();
+    LatencyHistogram previous_latency;
+    LatencyHistogram previous_commit_latency;
+    WorkerPool::Stats previous_pool_stats;
+    uint64_t max_queued = 0;
+    auto previous_partitions =
+        merge_partition_counters(partition_counters, partitions);
+    auto previous_partitions_time = std::chrono::steady_clock::now();
     while (!StopSignalGuard::is_stop_requested()) {
       std::this_thread::sleep_for(report_interval);
 
-      const auto current_consumed = consumed_messages.load();
-      const auto current_bytes = consumed_bytes.load();
-      const auto current_errors = poll_errors.load();
-      const auto delta = current_consumed - previous_consumed;
+      const auto current = counters.snapshot();
+      const auto current_consumed =
+          current.total(ConsumeCounter::ConsumedMessages);
+      const auto current_bytes = current.total(ConsumeCounter::ConsumedBytes);
+      const auto current_errors = current.total(ConsumeCounter::PollErrors);
+      const auto delta =
+          current_consumed - previous.total(ConsumeCounter::ConsumedMessages);
       const auto rate = static_cast<double>(delta) * 1000.0 /
                         static_cast<double>(report_interval_ms);
+      const auto current_latency = merge_snapshots(latency_recorders);
+      const auto current_commit_latency =
+          merge_snapshots(commit_latency_recorders);
+      const auto interval_commit_latency =
+          current_commit_latency.since(previous_commit_latency);
+      const auto interval_latency = current_latency.since(previous_latency);
+      const auto batches_delta = current.total(ConsumeCounter::Batches) -
+                                 previous.total(ConsumeCounter::Batches);
+      std::optional<WorkerPool::Stats> pool_stats;
+      uint64_t interval_max_queued = 0;
+      if (worker_pool.has_value()) {
+        pool_stats = worker_pool->stats();
+        interval_max_queued = worker_pool->take_max_queued();
+        max_queued = std::max(max_queued, interval_max_queued);
+      }
 
       {
         std::lock_guard<std::mutex> lock(output_mu);
-        logging::out() << "Consumed " << current_consumed << " messages ("
-                       << rate << " msg/s), bytes: " << current_bytes
-                       << ", poll errors: " << current_errors;
+        auto line = logging::out();
+        line << "Consumed " << current_consumed << " messages (" << rate
+             << " msg/s), bytes: " << current_bytes
+             << ", poll errors: " << current_errors;
+        if (batch_size > 0 && batches_delta > 0) {
+          line << ", avg batch: "
+               << static_cast<double>(delta) /
+                      static_cast<double>(batches_delta)
+               << " messages";
+        }
+        if (interval_latency.count() > 0) {
+          line << ", latency " << interval_latency.format_percentiles();
+        }
+        auto interval = [&current, &previous](ConsumeCounter counter) {
+          return current.total(counter) - previous.total(counter);
+        };
+        if (commit_mode != OffsetCommitter::Mode::Auto) {
+          line << ", commits: " << interval(ConsumeCounter::Commits)
+               << " (failed: " << interval(ConsumeCounter::CommitFailures)
+               << ", retried: " << interval(ConsumeCounter::CommitRetries)
+               << ")";
+          if (interval_commit_latency.count() > 0) {
+            line << ", commit latency "
+                 << interval_commit_latency.format_percentiles();
+          }
+        }
+        if (verify) {
+          line << ", gaps: " << interval(ConsumeCounter::Gaps)
+               << ", duplicates: "
+               << interval(ConsumeCounter::DuplicateMessages)
+               << ", out-of-order: "
+               << interval(ConsumeCounter::ReorderedMessages)
+               << ", late: " << interval(ConsumeCounter::LateMessages);
+        }
+        if (const auto thread_rates = format_shard_rates(
+                current, previous, ConsumeCounter::ConsumedMessages,
+                report_interval_ms / 1000.0, "consumer");
+            !thread_rates.empty()) {
+          line << ", " << thread_rates;
+        }
+        if (pool_stats.has_value()) {
+          report_worker_pool(
+              line, pool_stats->processed - previous_pool_stats.processed,
+              pool_stats->busy_ns - previous_pool_stats.busy_ns,
+              worker_pool->workers(),
+              std::chrono::milliseconds(report_interval_ms));
+          line << ", queue depth: " << worker_pool->queued()
+               << " (max: " << interval_max_queued << ")";
+        }
       }
-      previous_consumed = current_consumed;
+      if (metrics.has_value()) {
+        const auto interval_s = report_interval_ms / 1000.0;
+        MetricsEmitter::Sample sample;
+        sample.add_total("consumed_messages_total", current_consumed);
+        sample.add_total("consumed_bytes_total", current_bytes);
+        sample.add_total("poll_errors_total", current_errors);
+        sample.add("consume_rate", rate);
+        sample.add("consume_bytes_rate",
+                   static_cast<double>(
+                       current_bytes -
+                       previous.total(ConsumeCounter::ConsumedBytes)) /
+                       interval_s);
+        sample.add_latency("latency", interval_latency);
+        if (commit_mode != OffsetCommitter::Mode::Auto) {
+          sample.add_total("commits_total",
+                           current.total(ConsumeCounter::Commits));
+          sample.add_total("commit_failures_total",
+                           current.total(ConsumeCounter::CommitFailures));
+          sample.add_total("commit_retries_total",
+                           current.total(ConsumeCounter::CommitRetries));
+          sample.add_latency("commit_latency", interval_commit_latency);
+        }
+        if (verify) {
+          sample.add_total("gaps_total", current.total(ConsumeCounter::Gaps));
+          sample.add_total("late_messages_total",
+                           current.total(ConsumeCounter::LateMessages));
+          sample.add_total("duplicate_messages_total",
+                           current.total(ConsumeCounter::DuplicateMessages));
+          sample.add_total("reordered_messages_total",
+                           current.total(ConsumeCounter::ReorderedMessages));
+        }
+        if (pool_stats.has_value()) {
+          sample.add_total("processed_messages_total", pool_stats->processed);
+          sample.add("processed_rate",
+                     static_cast<double>(pool_stats->processed -
+                                         previous_pool_stats.processed) /
+                         interval_s);
+          sample.add("worker_utilization",
+                     static_cast<double>(pool_stats->busy_ns -
+                                         previous_pool_stats.busy_ns) /
+                         1e9 / interval_s /
+                         static_cast<double>(worker_pool->workers()));
+          sample.add("worker_queue_depth",
+                     static_cast<double>(worker_pool->queued()));
+        }
+        metrics->emit(std::move(sample));
+      }
+      if (pool_stats.has_value()) {
+        previous_pool_stats = std::move(*pool_stats);
+      }
+      if (client_stats.has_value()) {
+        std::lock_guard<std::mutex> lock(output_mu);
+        client_stats->report();
+      }
+      if (top_partitions > 0 && partitions > 0) {
+        auto current_partitions =
+            merge_partition_counters(partition_counters, partitions);
+        const auto now = std::chrono::steady_clock::now();
+        report_hot_partitions(
+            current_partitions, previous_partitions,
+            static_cast<size_t>(top_partitions),
+            std::chrono::duration<double>(now - previous_partitions_time)
+                .count(),
+            output_mu);
+        previous_partitions = std::move(current_partitions);
+        previous_partitions_time = now;
+      }
+      previous = current;
+      previous_latency = current_latency;
+      previous_commit_latency = current_commit_latency;
 
       {
         std::lock_guard<std::mutex> lock(errors_mu);
@@ -225,16 +928,116 @@ public:
       }
     }
 
+    const auto stop_time =
+        bounds.finish_time().value_or(std::chrono::steady_clock::now());
     for (auto &thread : threads) {
       thread.join();
     }
+    if (debug_printer.has_value()) {
+      debug_printer->stop();
+    }
+    if (worker_pool.has_value()) {
+      worker_pool->stop();
+    }
+    const auto pool_stop_time = std::chrono::steady_clock::now();
+    if (metrics.has_value()) {
+      try {
+        metrics->close();
+      } catch (const std::exception &e) {
+        add_error(e.what());
+      }
+    }
+    if (sink.has_value()) {
+      try {
+        sink->close();
+      } catch (const std::exception &e) {
+        add_error(e.what());
+      }
+    }
 
     {
       std::lock_guard<std::mutex> lock(output_mu);
       logging::out() << "Stopped consumers. Consumed "
-                     << consumed_messages.load()
-                     << " messages, bytes: " << consumed_bytes.load()
-                     << ", poll errors: " << poll_errors.load();
+                     << counters.total(ConsumeCounter::ConsumedMessages)
+                     << " messages, bytes: "
+                     << counters.total(ConsumeCounter::ConsumedBytes)
+                     << ", poll errors: "
+                     << counters.total(ConsumeCounter::PollErrors);
+      if (const auto batches = counters.total(ConsumeCounter::Batches);
+          batch_size > 0 && batches > 0) {
+        logging::out() << "Read " << batches << " batches, avg batch: "
+                       << static_cast<double>(counters.total(
+                              ConsumeCounter::ConsumedMessages)) /
+                              static_cast<double>(batches)
+                       << " messages";
+      }
+      if (verify) {
+        logging::out() << "Verified sequences. Gaps: "
+                       << counters.total(ConsumeCounter::Gaps)
+                       << ", not received yet: " << verifier.pending_gaps()
+                       << ", late: "
+                       << counters.total(ConsumeCounter::LateMessages)
+                       << ", duplicates: "
+                       << counters.total(ConsumeCounter::DuplicateMessages)
+                       << ", out-of-order: "
+                       << counters.total(ConsumeCounter::ReorderedMessages)
+                       << ", without header: "
+                       << counters.total(ConsumeCounter::UnverifiedMessages);
+      }
+      report_drain_time(counters, stop_time - start_time,
+                        std::chrono::nanoseconds(first_message_ns.load()));
+      if (debug_printer.has_value()) {
+        const auto debug_stats = debug_printer->stats();
+        logging::out() << "Printed " << debug_stats.printed
+                       << " debug messages, dropped " << debug_stats.dropped
+                       << " (printing fell behind), "
+                       << debug_stats.rate_limited << " over the rate cap";
+      }
+      if (worker_pool.has_value()) {
+        const auto pool_stats = worker_pool->stats();
+        max_queued = std::max(max_queued, worker_pool->take_max_queued());
+        auto line = logging::out();
+        line << "Processed " << pool_stats.processed << " messages with "
+             << worker_pool->workers() << " workers";
+        report_worker_pool(line, pool_stats.processed, pool_stats.busy_ns,
+                           worker_pool->workers(),
+                           pool_stop_time - start_time);
+        line << ", max queue depth: " << max_queued;
+        if (pool_stats.wait.count() > 0) {
+          line << ", queue wait " << pool_stats.wait.format_percentiles();
+        }
+      }
+      if (sink.has_value()) {
+        auto line = logging::out();
+        line << "Exported " << sink->written_bytes() << " bytes to "
+             << (sink->path() == "-" ? "stdout" : sink->path());
+        if (sink->files() > 1) {
+          line << " (" << sink->files() << " files)";
+        }
+      }
+      if (commit_mode != OffsetCommitter::Mode::Auto) {
+        auto line = logging::out();
+        line << "Committed offsets " << counters.total(ConsumeCounter::Commits)
+             << " times, failed: "
+             << counters.total(ConsumeCounter::CommitFailures)
+             << ", retried: " << counters.total(ConsumeCounter::CommitRetries);
+        if (const auto latency = merge_snapshots(commit_latency_recorders);
+            latency.count() > 0) {
+          line << ", commit latency " << latency.format_percentiles();
+        }
+      }
+      if (const auto latency = merge_snapshots(latency_recorders);
+          latency.count() > 0) {
+        logging::out() << "End-to-end latency of " << latency.count()
+                       << " messages: " << latency.format_percentiles();
+      }
+    }
+
+    rebalance_summary.report();
+    if (partitions > 0) {
+      report_partitions(
+          merge_partition_counters(partition_counters, partitions),
+          assignments, counters.snapshot());
     }
 
     if (!errors.empty()) {
@@ -258,6 +1061,221 @@ private:
     return group_id + "-consumer-" + std::to_string(consumer_index);
   }
 
+  // The partitions of `topic` in the current assignment
+  static std::vector<int32_t> assigned_partitions(rd_kafka_t *rk,
+                                                  const std::string &topic) {
+    std::vector<int32_t> partitions;
+    rd_kafka_topic_partition_list_t *assignment = nullptr;
+    if (rd_kafka_assignment(rk, &assignment) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+      return partitions;
+    }
+    GUARD(assignment, rd_kafka_topic_partition_list_destroy);
+    for (int i = 0; i < assignment->cnt; i++) {
+      if (topic == assignment->elems[i].topic) {
+        partitions.emplace_back(assignment->elems[i].partition);
+      }
+    }
+    return partitions;
+  }
+
+  // The end offset of each partition, which must be known to stop there
+  static std::vector<int64_t> query_end_offsets(rd_kafka_t *rk,
+                                                const std::string &topic,
+                                                size_t partitions) {
+    std::vector<int32_t> all_partitions(partitions);
+    for (size_t i = 0; i < partitions; i++) {
+      all_partitions[i] = static_cast<int32_t>(i);
+    }
+    auto end_offsets = query_high_watermarks(rk, topic, all_partitions, 10000);
+    for (size_t i = 0; i < partitions; i++) {
+      if (end_offsets[i] < 0) {
+        throw std::runtime_error(
+            "Failed to query the end offset of partition " +
+            std::to_string(i));
+      }
+    }
+    return end_offsets;
+  }
+
+  static void pause_partition(rd_kafka_t *rk,
+                              const rd_kafka_message_t *message) {
+    auto *partitions = rd_kafka_topic_partition_list_new(1);
+    GUARD(partitions, rd_kafka_topic_partition_list_destroy);
+    rd_kafka_topic_partition_list_add(partitions,
+                                      rd_kafka_topic_name(message->rkt),
+                                      message->partition);
+    rd_kafka_pause_partitions(rk, partitions);
+  }
+
+  // Print how long consuming took and the throughput since the first message,
+  // which excludes joining the group
+  static void report_drain_time(const ConsumeCounters &counters,
+                                std::chrono::nanoseconds elapsed,
+                                std::chrono::nanoseconds first_message) {
+    const auto seconds = [](std::chrono::nanoseconds duration) {
+      return std::chrono::duration<double>(duration).count();
+    };
+    auto line = logging::out();
+    line << "Drain time: " << seconds(elapsed) << " s";
+    if (first_message.count() == 0 || first_message >= elapsed) {
+      return;
+    }
+    const auto draining = seconds(elapsed - first_message);
+    line << " (first message after " << seconds(first_message) << " s), "
+         << static_cast<double>(
+                counters.total(ConsumeCounter::ConsumedMessages)) /
+                draining
+         << " msg/s, "
+         << static_cast<double>(counters.total(ConsumeCounter::ConsumedBytes)) /
+                draining / 1e6
+         << " MB/s";
+  }
+
+  // Append the processing rate, the worker utilization and the rate the pool
+  // could sustain at full utilization
+  static void report_worker_pool(logging::Line &line, uint64_t processed,
+                                 uint64_t busy_ns, size_t workers,
+                                 std::chrono::nanoseconds elapsed) {
+    const auto seconds = std::chrono::duration<double>(elapsed).count();
+    if (seconds <= 0) {
+      return;
+    }
+    const auto rate = static_cast<double>(processed) / seconds;
+    const auto utilization = static_cast<double>(busy_ns) / 1e9 / seconds /
+                             static_cast<double>(workers);
+    line << ", processed: " << rate
+         << " msg/s, worker utilization: " << utilization * 100 << "%";
+    if (utilization > 0) {
+      line << ", ceiling: " << rate / utilization << " msg/s";
+    }
+  }
+
+  static std::string format_lag(int64_t high_watermark, int64_t next_offset) {
+    if (high_watermark < 0 || next_offset < 0) {
+      return "-";
+    }
+    return std::to_string(std::max<int64_t>(0, high_watermark - next_offset));
+  }
+
+  // Print the rate and lag of the partitions that consumed the most messages
+  // since `previous`, which was merged `interval_s` seconds ago. The lag comes
+  // from the high watermarks cached by the consumers, so the report never waits
+  // for a partition leader.
+  static void report_hot_partitions(
+      const std::vector<PartitionCounters::Totals> &current,
+      const std::vector<PartitionCounters::Totals> &previous, size_t top,
+      double interval_s, std::mutex &output_mu) {
+    std::vector<int32_t> hot(current.size());
+    for (size_t i = 0; i < hot.size(); i++) {
+      hot[i] = static_cast<int32_t>(i);
+    }
+    auto delta = [&current, &previous](int32_t partition) {
+      return current[partition].messages - previous[partition].messages;
+    };
+    top = std::min(top, hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + top, hot.end(),
+                      [&delta](int32_t lhs, int32_t rhs) {
+                        return delta(lhs) > delta(rhs);
+                      });
+    hot.resize(top);
+    while (!hot.empty() && delta(hot.back()) == 0) {
+      hot.pop_back();
+    }
+    if (hot.empty()) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(output_mu);
+    auto line = logging::out();
+    line << "Hot partitions:";
+    for (size_t i = 0; i < hot.size(); i++) {
+      const auto partition = hot[i];
+      line << (i == 0 ? " " : ", ") << "[" << partition << "] "
+           << static_cast<double>(delta(partition)) / interval_s
+           << " msg/s (lag: "
+           << format_lag(current[partition].high_watermark,
+                         current[partition].next_offset)
+           << ")";
+    }
+  }
+
+  // Print the consumed messages and lag of each partition, and how skewed the
+  // final assignment is across consumers
+  static void
+  report_partitions(const std::vector<PartitionCounters::Totals> &totals,
+                    const std::vector<std::vector<int32_t>> &assignments,
+                    const ConsumeCounters::Snapshot &counters) {
+    uint64_t total = 0;
+    uint64_t max_count = 0;
+    for (auto &&partition : totals) {
+      total += partition.messages;
+      max_count = std::max(max_count, partition.messages);
+    }
+    if (total == 0) {
+      return;
+    }
+
+    std::vector<int> owners(totals.size(), -1);
+    for (size_t consumer = 0; consumer < assignments.size(); consumer++) {
+      for (auto partition : assignments[consumer]) {
+        if (partition >= 0 && static_cast<size_t>(partition) < owners.size()) {
+          owners[partition] = static_cast<int>(consumer);
+        }
+      }
+    }
+
+    const auto mean =
+        static_cast<double>(total) / static_cast<double>(totals.size());
+    logging::out() << "Consumed messages of " << totals.size()
+                   << " partition" << (totals.size() == 1 ? "" : "s")
+                   << " (max/mean: " << static_cast<double>(max_count) / mean
+                   << "):";
+    logging::out()
+        << "| partition | consumer | messages | bytes | share | lag |";
+    for (size_t i = 0; i < totals.size(); i++) {
+      logging::out() << "| " << i << " | "
+                     << (owners[i] < 0 ? std::string("-")
+                                       : std::to_string(owners[i]))
+                     << " | " << totals[i].messages << " | "
+                     << totals[i].bytes << " | "
+                     << static_cast<double>(totals[i].messages) * 100.0 /
+                            static_cast<double>(total)
+                     << "% | "
+                     << format_lag(totals[i].high_watermark,
+                                   totals[i].next_offset)
+                     << " |";
+    }
+
+    uint64_t max_consumed = 0;
+    for (size_t consumer = 0; consumer < counters.size(); consumer++) {
+      max_consumed = std::max(
+          max_consumed,
+          counters.get(consumer, ConsumeCounter::ConsumedMessages));
+    }
+    const auto consumer_mean = static_cast<double>(total) /
+                               static_cast<double>(counters.size());
+    logging::out() << "Consumed messages of " << counters.size()
+                   << " consumer" << (counters.size() == 1 ? "" : "s")
+                   << " (max/mean: "
+                   << static_cast<double>(max_consumed) / consumer_mean
+                   << "):";
+    logging::out() << "| consumer | assigned partitions | messages |";
+    for (size_t consumer = 0; consumer < counters.size(); consumer++) {
+      auto line = logging::out();
+      line << "| " << consumer << " | ";
+      if (assignments[consumer].empty()) {
+        line << "(none)";
+      }
+      for (size_t i = 0; i < assignments[consumer].size(); i++) {
+        line << (i == 0 ? "" : ", ") << assignments[consumer][i];
+      }
+      line << " | " << counters.get(consumer, ConsumeCounter::ConsumedMessages)
+           << " |";
+    }
+  }
+
+  static void detach_batch_reader(BatchReader *reader) { reader->detach(); }
+
   static const char *rebalance_action(rd_kafka_resp_err_t err) noexcept {
     switch (err) {
     case RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS:
@@ -296,41 +1314,4 @@ private:
     GUARD(assignment, rd_kafka_topic_partition_list_destroy);
     return format_partitions(assignment);
   }
-
-  static std::string message_topic(const rd_kafka_message_t *message) {
-    if (message == nullptr || message->rkt == nullptr) {
-      return "(unknown)";
-    }
-    return rd_kafka_topic_name(message->rkt);
-  }
-
-  static std::string message_timestamp(const rd_kafka_message_t *message) {
-    if (message == nullptr) {
-      return "(unknown)";
-    }
-
-    rd_kafka_timestamp_type_t timestamp_type = RD_KAFKA_TIMESTAMP_NOT_AVAILABLE;
-    const auto timestamp = rd_kafka_message_timestamp(message, &timestamp_type);
-    if (timestamp < 0 || timestamp_type == RD_KAFKA_TIMESTAMP_NOT_AVAILABLE) {
-      return "not available";
-    }
-
-    const auto timestamp_time_point = std::chrono::system_clock::time_point(
-        std::chrono::milliseconds(timestamp));
-    return logging::format_timestamp(timestamp_time_point) + " (" +
-           timestamp_type_name(timestamp_type) + ")";
-  }
-
-  static std::string
-  timestamp_type_name(rd_kafka_timestamp_type_t timestamp_type) {
-    switch (timestamp_type) {
-    case RD_KAFKA_TIMESTAMP_CREATE_TIME:
-      return "create_time";
-    case RD_KAFKA_TIMESTAMP_LOG_APPEND_TIME:
-      return "log_append_time";
-    case RD_KAFKA_TIMESTAMP_NOT_AVAILABLE:
-      return "not_available";
-    }
-    return "unknown";
-  }
 };
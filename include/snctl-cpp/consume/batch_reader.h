@@ -0,0 +1,267 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/logging.h"
+#include "snctl-cpp/queue_events.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <librdkafka/rdkafka.h>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Read messages with rd_kafka_consume_batch_queue(), either from the consumer
+// queue or from the queue of each assigned partition, whose forwarding to the
+// consumer queue is disabled. The consumer queue is still served in both modes,
+// since rebalance events and errors are delivered there.
+//
+// With partition queues, the fetched messages never reach the consumer queue,
+// so the reader waits for any of the queues to signal a QueueEventFd instead of
+// blocking on the consumer queue.
+//
+// The reader is used by a single consumer thread, which also runs the
+// rebalance callback from within read().
+class BatchReader final {
+public:
+  BatchReader(size_t batch_size, bool partition_queues)
+      : messages_(batch_size), partition_queues_enabled_(partition_queues),
+        consumer_queue_(nullptr, &rd_kafka_queue_destroy) {
+    if (batch_size == 0) {
+      throw std::invalid_argument("The batch size must be greater than 0");
+    }
+  }
+
+  BatchReader(const BatchReader &) = delete;
+  BatchReader &operator=(const BatchReader &) = delete;
+
+  ~BatchReader() { detach(); }
+
+  void attach(rd_kafka_t *rk) {
+    consumer_queue_.reset(rd_kafka_queue_get_consumer(rk));
+    if (!consumer_queue_) {
+      throw std::runtime_error("Failed to get the consumer queue");
+    }
+    if (partition_queues_enabled_) {
+      consumer_events_ = make_events(rd_kafka_queue_get_consumer(rk));
+      waiter_.reset();
+    }
+  }
+
+  // Release all queues, which must happen before the client is destroyed
+  void detach() noexcept {
+    waiter_.reset();
+    // The partition queues are forwarded back to the consumer queue
+    partition_queues_.clear();
+    consumer_events_.reset();
+    consumer_queue_.reset();
+  }
+
+  // Must be called by the rebalance callback after the assignment is updated
+  void on_rebalance(rd_kafka_t *rk, rd_kafka_resp_err_t err,
+                    const rd_kafka_topic_partition_list_t *partitions) {
+    if (!partition_queues_enabled_) {
+      return;
+    }
+    if (err != RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS) {
+      if (err != RD_KAFKA_RESP_ERR__REVOKE_PARTITIONS ||
+          partitions == nullptr) {
+        partition_queues_.clear();
+        waiter_.reset();
+        return;
+      }
+      for (int i = 0; i < partitions->cnt; i++) {
+        remove_partition_queue(partitions->elems[i]);
+      }
+      waiter_.reset();
+      return;
+    }
+    if (partitions == nullptr) {
+      return;
+    }
+    for (int i = 0; i < partitions->cnt; i++) {
+      const auto &partition = partitions->elems[i];
+      remove_partition_queue(partition);
+      auto *queue = rd_kafka_queue_get_partition(rk, partition.topic,
+                                                 partition.partition);
+      if (queue == nullptr) {
+        continue;
+      }
+      rd_kafka_queue_forward(queue, nullptr);
+      partition_queues_.emplace_back(partition.topic, partition.partition,
+                                     queue, consumer_queue_.get());
+      // The event fd holds its own reference of the queue
+      partition_queues_.back().events =
+          make_events(rd_kafka_queue_get_partition(rk, partition.topic,
+                                                   partition.partition));
+    }
+    waiter_.reset();
+  }
+
+  // Read one batch from each queue and call `on_message` for each message,
+  // which is destroyed afterwards. Wait up to `timeout_ms` for a message if all
+  // queues are empty. Return the number of non-empty batches read.
+  template <typename OnMessage>
+  uint64_t read(int timeout_ms, OnMessage &&on_message) {
+    if (!partition_queues_enabled_) {
+      return read_batch(consumer_queue_.get(), timeout_ms, on_message) > 0 ? 1
+                                                                           : 0;
+    }
+    auto batches = read_all_queues(on_message);
+    if (batches == 0 && timeout_ms > 0) {
+      wait_for_events(timeout_ms);
+      batches = read_all_queues(on_message);
+    }
+    return batches;
+  }
+
+private:
+  struct PartitionQueue {
+    std::string topic;
+    int32_t partition;
+    std::unique_ptr<rd_kafka_queue_t, decltype(&rd_kafka_queue_destroy)> queue;
+    rd_kafka_queue_t *consumer_queue;
+    std::unique_ptr<QueueEventFd> events;
+
+    PartitionQueue(std::string topic, int32_t partition,
+                   rd_kafka_queue_t *queue, rd_kafka_queue_t *consumer_queue)
+        : topic(std::move(topic)), partition(partition),
+          queue(queue, &rd_kafka_queue_destroy),
+          consumer_queue(consumer_queue) {}
+
+    PartitionQueue(PartitionQueue &&) = default;
+
+    // The replaced queue is released like in the destructor
+    PartitionQueue &operator=(PartitionQueue &&other) noexcept {
+      if (this != &other) {
+        release();
+        topic = std::move(other.topic);
+        partition = other.partition;
+        queue = std::move(other.queue);
+        consumer_queue = other.consumer_queue;
+        events = std::move(other.events);
+      }
+      return *this;
+    }
+
+    ~PartitionQueue() { release(); }
+
+    void release() noexcept {
+      events.reset();
+      // Restore the forwarding in case the partition stays assigned
+      if (queue) {
+        rd_kafka_queue_forward(queue.get(), consumer_queue);
+        queue.reset();
+      }
+    }
+  };
+
+  std::vector<rd_kafka_message_t *> messages_;
+  const bool partition_queues_enabled_;
+  std::unique_ptr<rd_kafka_queue_t, decltype(&rd_kafka_queue_destroy)>
+      consumer_queue_;
+  std::vector<PartitionQueue> partition_queues_;
+  // Only with partition queues, the waiter is rebuilt after a rebalance
+  std::unique_ptr<QueueEventFd> consumer_events_;
+  std::optional<QueueEventWaiter> waiter_;
+
+  // The event fds are drained before their queues are read, so that a message
+  // that arrives in between signals the next wait
+  template <typename OnMessage>
+  uint64_t read_all_queues(OnMessage &on_message) {
+    uint64_t batches = 0;
+    // The rebalance callback may change the partition queues, so they are
+    // indexed instead of iterated
+    for (size_t i = 0; i < partition_queues_.size(); i++) {
+      if (auto &events = partition_queues_[i].events) {
+        events->drain();
+      }
+      if (read_batch(partition_queues_[i].queue.get(), 0, on_message) > 0) {
+        batches++;
+      }
+    }
+    if (consumer_events_) {
+      consumer_events_->drain();
+    }
+    if (read_batch(consumer_queue_.get(), 0, on_message) > 0) {
+      batches++;
+    }
+    return batches;
+  }
+
+  void wait_for_events(int timeout_ms) {
+    if (!waiter_.has_value()) {
+      waiter_.emplace();
+      if (consumer_events_) {
+        waiter_->add(consumer_events_->fd(), 0);
+      }
+      for (size_t i = 0; i < partition_queues_.size(); i++) {
+        if (auto &events = partition_queues_[i].events) {
+          waiter_->add(events->fd(), i + 1);
+        }
+      }
+    }
+    waiter_->wait(std::chrono::milliseconds(timeout_ms));
+  }
+
+  // It runs in the rebalance callback, which must not throw. Without an event
+  // fd, a queue's messages just wait for the next wakeup or timeout.
+  static std::unique_ptr<QueueEventFd> make_events(rd_kafka_queue_t *queue) {
+    if (queue == nullptr) {
+      return nullptr;
+    }
+    try {
+      return std::make_unique<QueueEventFd>(queue);
+    } catch (const std::exception &e) {
+      logging::err() << "Failed to watch a queue: " << e.what();
+      return nullptr;
+    }
+  }
+
+  template <typename OnMessage>
+  size_t read_batch(rd_kafka_queue_t *queue, int timeout_ms,
+                    OnMessage &on_message) {
+    const auto size = rd_kafka_consume_batch_queue(
+        queue, timeout_ms, messages_.data(), messages_.size());
+    if (size <= 0) {
+      return 0;
+    }
+    for (ssize_t i = 0; i < size; i++) {
+      on_message(messages_[i]);
+      rd_kafka_message_destroy(messages_[i]);
+    }
+    return static_cast<size_t>(size);
+  }
+
+  void remove_partition_queue(const rd_kafka_topic_partition_t &partition) {
+    for (size_t i = 0; i < partition_queues_.size(); i++) {
+      auto &queue = partition_queues_[i];
+      if (queue.partition == partition.partition &&
+          queue.topic == partition.topic) {
+        if (i + 1 != partition_queues_.size()) {
+          queue = std::move(partition_queues_.back());
+        }
+        partition_queues_.pop_back();
+        return;
+      }
+    }
+  }
+};
@@ -0,0 +1,271 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/raii_helper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <librdkafka/rdkafka.h>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Where consumption of a topic starts and ends, shared by all consumers.
+//
+// Each partition may have a start offset, which overrides the committed offset
+// when it's assigned, and a stop offset, which is excluded. Consumption is
+// finished once every partition reaches its stop offset or once the maximum
+// number of messages is consumed.
+class ConsumeBounds final {
+public:
+  explicit ConsumeBounds(size_t partitions, uint64_t max_messages = 0)
+      : partitions_(partitions), max_messages_(max_messages),
+        started_(std::make_unique<std::atomic<bool>[]>(partitions)),
+        done_(std::make_unique<std::atomic<bool>[]>(partitions)) {}
+
+  ConsumeBounds(const ConsumeBounds &) = delete;
+  ConsumeBounds &operator=(const ConsumeBounds &) = delete;
+
+  // RD_KAFKA_OFFSET_END for the partitions without any message at or after the
+  // start timestamp
+  void set_start_offsets(std::vector<int64_t> offsets) {
+    start_offsets_ = std::move(offsets);
+  }
+
+  // Only consume `partitions`, e.g. of a static assignment, so that the other
+  // partitions don't have to reach their stop offsets. It must be called
+  // before set_stop_offsets().
+  void restrict_to(const std::vector<int32_t> &partitions) {
+    std::vector<bool> included(partitions_, false);
+    for (auto partition : partitions) {
+      if (in_range(partition)) {
+        included[partition] = true;
+      }
+    }
+    excluded_partitions_ = 0;
+    for (size_t i = 0; i < partitions_; i++) {
+      if (!included[i]) {
+        done_[i].store(true, std::memory_order_relaxed);
+        excluded_partitions_++;
+      }
+    }
+  }
+
+  // Keep the lower stop offset of each partition if called more than once
+  void set_stop_offsets(const std::vector<int64_t> &offsets) {
+    if (stop_offsets_.empty()) {
+      stop_offsets_ = offsets;
+    } else {
+      for (size_t i = 0; i < offsets.size(); i++) {
+        stop_offsets_[i] = std::min(stop_offsets_[i], offsets[i]);
+      }
+    }
+    remaining_partitions_ = stop_offsets_.size() - excluded_partitions_;
+  }
+
+  bool has_stop_offsets() const noexcept { return !stop_offsets_.empty(); }
+
+  // Set the start offsets of the partitions to assign. A partition that moves
+  // to another consumer later resumes from its committed offset instead.
+  void apply_start_offsets(rd_kafka_topic_partition_list_t *partitions) {
+    if (start_offsets_.empty()) {
+      return;
+    }
+    for (int i = 0; i < partitions->cnt; i++) {
+      auto &partition = partitions->elems[i];
+      if (in_range(partition.partition) &&
+          !started_[partition.partition].exchange(true)) {
+        partition.offset = start_offsets_[partition.partition];
+      }
+    }
+  }
+
+  // Return whether a consumed message is within the bounds and should be
+  // processed. `reached_stop` is set when the partition reaches its stop
+  // offset, after which it can be paused.
+  bool accept(int32_t partition, int64_t offset, bool &reached_stop) {
+    reached_stop = false;
+    if (!stop_offsets_.empty() && in_range(partition)) {
+      const auto stop = stop_offsets_[partition];
+      if (offset + 1 >= stop) {
+        reached_stop = true;
+        mark_done(partition);
+        if (offset >= stop) {
+          return false;
+        }
+      }
+    }
+    if (max_messages_ > 0) {
+      const auto claimed = claimed_.fetch_add(1, std::memory_order_relaxed);
+      if (claimed >= max_messages_) {
+        return false;
+      }
+      if (claimed + 1 == max_messages_) {
+        finish();
+      }
+    }
+    return true;
+  }
+
+  // Called on RD_KAFKA_RESP_ERR__PARTITION_EOF, since the last offsets before
+  // the end can be transaction markers or compacted away
+  void on_partition_eof(int32_t partition, int64_t offset) {
+    if (stop_offsets_.empty() || !in_range(partition)) {
+      return;
+    }
+    if (offset >= stop_offsets_[partition]) {
+      mark_done(partition);
+    }
+  }
+
+  bool finished() const noexcept {
+    return finished_.load(std::memory_order_acquire);
+  }
+
+  // The time when consumption finished, if it did
+  std::optional<std::chrono::steady_clock::time_point> finish_time() const {
+    if (!finished()) {
+      return std::nullopt;
+    }
+    return finish_time_;
+  }
+
+private:
+  const size_t partitions_;
+  const uint64_t max_messages_;
+  std::vector<int64_t> start_offsets_;
+  std::vector<int64_t> stop_offsets_;
+  std::unique_ptr<std::atomic<bool>[]> started_;
+  std::unique_ptr<std::atomic<bool>[]> done_;
+  size_t excluded_partitions_ = 0;
+  std::atomic<size_t> remaining_partitions_{0};
+  std::atomic<uint64_t> claimed_{0};
+  std::atomic<bool> finishing_{false};
+  std::atomic<bool> finished_{false};
+  std::chrono::steady_clock::time_point finish_time_;
+
+  bool in_range(int32_t partition) const noexcept {
+    return partition >= 0 && static_cast<size_t>(partition) < partitions_;
+  }
+
+  void mark_done(int32_t partition) {
+    if (done_[partition].exchange(true, std::memory_order_relaxed)) {
+      return;
+    }
+    if (remaining_partitions_.fetch_sub(1, std::memory_order_relaxed) == 1) {
+      finish();
+    }
+  }
+
+  void finish() {
+    if (finishing_.exchange(true)) {
+      return;
+    }
+    finish_time_ = std::chrono::steady_clock::now();
+    finished_.store(true, std::memory_order_release);
+  }
+};
+
+// The earliest offset of each partition whose timestamp is at or after
+// `timestamp_ms`, RD_KAFKA_OFFSET_END if there is none
+inline std::vector<int64_t> offsets_for_timestamp(rd_kafka_t *rk,
+                                                  const std::string &topic,
+                                                  size_t partitions,
+                                                  int64_t timestamp_ms,
+                                                  int timeout_ms) {
+  auto *list =
+      rd_kafka_topic_partition_list_new(static_cast<int>(partitions));
+  GUARD(list, rd_kafka_topic_partition_list_destroy);
+  for (size_t i = 0; i < partitions; i++) {
+    rd_kafka_topic_partition_list_add(list, topic.c_str(),
+                                      static_cast<int32_t>(i))
+        ->offset = timestamp_ms;
+  }
+  if (const auto err = rd_kafka_offsets_for_times(rk, list, timeout_ms);
+      err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+    throw std::runtime_error("Failed to query offsets for timestamp " +
+                             std::to_string(timestamp_ms) + ": " +
+                             rd_kafka_err2str(err));
+  }
+  std::vector<int64_t> offsets(partitions, RD_KAFKA_OFFSET_END);
+  for (int i = 0; i < list->cnt; i++) {
+    const auto &partition = list->elems[i];
+    if (partition.err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+      throw std::runtime_error(
+          "Failed to query offset for timestamp of partition " +
+          std::to_string(partition.partition) + ": " +
+          rd_kafka_err2str(partition.err));
+    }
+    if (partition.partition >= 0 &&
+        static_cast<size_t>(partition.partition) < partitions) {
+      offsets[partition.partition] = partition.offset;
+    }
+  }
+  return offsets;
+}
+
+// Parse milliseconds since the epoch, or a time relative to now like "-2h",
+// "-30m" or "-90s"
+inline int64_t parse_timestamp_ms(const std::string &value) {
+  auto fail = [&value]() -> int64_t {
+    throw std::invalid_argument(
+        "Invalid timestamp: " + value +
+        ", expected milliseconds since the epoch or e.g. -2h, -30m, -90s");
+  };
+  if (value.empty()) {
+    return fail();
+  }
+  size_t end = 0;
+  int64_t number = 0;
+  try {
+    number = std::stoll(value, &end);
+  } catch (const std::exception &) {
+    return fail();
+  }
+  if (end == value.size()) {
+    return number < 0 ? fail() : number;
+  }
+  if (value[0] != '-' || end + 1 != value.size()) {
+    return fail();
+  }
+  std::chrono::milliseconds offset;
+  switch (std::tolower(static_cast<unsigned char>(value[end]))) {
+  case 's':
+    offset = std::chrono::seconds(-number);
+    break;
+  case 'm':
+    offset = std::chrono::minutes(-number);
+    break;
+  case 'h':
+    offset = std::chrono::hours(-number);
+    break;
+  case 'd':
+    offset = std::chrono::hours(-number * 24);
+    break;
+  default:
+    return fail();
+  }
+  const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+  return (now - offset).count();
+}
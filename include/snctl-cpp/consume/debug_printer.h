@@ -0,0 +1,235 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/logging.h"
+#include "snctl-cpp/mpsc_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <librdkafka/rdkafka.h>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// Print the metadata of consumed messages without slowing down the consumers.
+// Consumer threads sample the messages and push their metadata into a
+// lock-free ring, and a writer thread formats them and writes them in batches.
+// Messages are dropped rather than waited for when the ring is full.
+class DebugPrinter final {
+public:
+  struct Stats {
+    uint64_t printed = 0;
+    // Dropped because the ring was full
+    uint64_t dropped = 0;
+    // Skipped because of the rate cap
+    uint64_t rate_limited = 0;
+  };
+
+  // The sampling state of a consumer thread
+  class Sampler final {
+  public:
+    Sampler(DebugPrinter &printer, int consumer_index)
+        : printer_(printer), consumer_index_(consumer_index),
+          tokens_(printer.burst_), last_refill_(clock::now()) {}
+
+    Sampler(const Sampler &) = delete;
+    Sampler &operator=(const Sampler &) = delete;
+
+    ~Sampler() {
+      printer_.dropped_.fetch_add(dropped_, std::memory_order_relaxed);
+      printer_.rate_limited_.fetch_add(rate_limited_,
+                                       std::memory_order_relaxed);
+    }
+
+    void record(const rd_kafka_message_t *message) noexcept {
+      if (++seen_ < printer_.sample_every_) {
+        return;
+      }
+      seen_ = 0;
+      if (printer_.rate_per_consumer_ > 0 && !take_token()) {
+        rate_limited_++;
+        return;
+      }
+      Record record;
+      record.consumer_index = consumer_index_;
+      record.partition = message->partition;
+      record.offset = message->offset;
+      record.timestamp_ms =
+          rd_kafka_message_timestamp(message, &record.timestamp_type);
+      if (!printer_.ring_.try_push(record)) {
+        dropped_++;
+      }
+    }
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    DebugPrinter &printer_;
+    const int consumer_index_;
+    uint64_t seen_ = 0;
+    double tokens_;
+    clock::time_point last_refill_;
+    uint64_t dropped_ = 0;
+    uint64_t rate_limited_ = 0;
+
+    bool take_token() noexcept {
+      const auto now = clock::now();
+      tokens_ = std::min(printer_.burst_,
+                         tokens_ + std::chrono::duration<double>(
+                                       now - last_refill_)
+                                           .count() *
+                                       printer_.rate_per_consumer_);
+      last_refill_ = now;
+      if (tokens_ < 1) {
+        return false;
+      }
+      tokens_ -= 1;
+      return true;
+    }
+  };
+
+  // Print every `sample_every`-th message of each consumer, and at most
+  // `max_rate` messages per second across `consumers` consumers, 0 means no
+  // cap
+  DebugPrinter(std::string topic, uint64_t sample_every, double max_rate,
+               size_t consumers)
+      : topic_(std::move(topic)), sample_every_(sample_every),
+        rate_per_consumer_(max_rate / static_cast<double>(consumers)),
+        burst_(std::max(1.0, rate_per_consumer_)), ring_(ring_capacity) {
+    if (sample_every == 0) {
+      throw std::invalid_argument("The debug sample must be greater than 0");
+    }
+    if (max_rate < 0) {
+      throw std::invalid_argument("The debug rate cap must not be negative");
+    }
+    writer_ = std::thread([this] { run(); });
+  }
+
+  DebugPrinter(const DebugPrinter &) = delete;
+  DebugPrinter &operator=(const DebugPrinter &) = delete;
+
+  ~DebugPrinter() { stop(); }
+
+  // Print the remaining messages and stop the writer thread
+  void stop() {
+    stopped_.store(true, std::memory_order_release);
+    if (writer_.joinable()) {
+      writer_.join();
+    }
+  }
+
+  // Complete after the samplers are destroyed and stop() is called
+  Stats stats() const noexcept {
+    return Stats{printed_.load(std::memory_order_relaxed),
+                 dropped_.load(std::memory_order_relaxed),
+                 rate_limited_.load(std::memory_order_relaxed)};
+  }
+
+private:
+  static constexpr size_t ring_capacity = 16384;
+  static constexpr size_t max_batch_bytes = 64 * 1024;
+
+  struct Record {
+    int consumer_index = 0;
+    int32_t partition = 0;
+    int64_t offset = 0;
+    int64_t timestamp_ms = 0;
+    rd_kafka_timestamp_type_t timestamp_type = RD_KAFKA_TIMESTAMP_NOT_AVAILABLE;
+  };
+
+  const std::string topic_;
+  const uint64_t sample_every_;
+  const double rate_per_consumer_;
+  const double burst_;
+  MpscRing<Record> ring_;
+  std::atomic<bool> stopped_{false};
+  std::atomic<uint64_t> printed_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> rate_limited_{0};
+  std::thread writer_;
+
+  void run() {
+    logging::TimestampFormatter now_formatter;
+    logging::TimestampFormatter timestamp_formatter;
+    std::string batch;
+    batch.reserve(max_batch_bytes + 256);
+    while (true) {
+      // Read the flag before draining, so nothing pushed before stop() is lost
+      const auto stopped = stopped_.load(std::memory_order_acquire);
+      Record record;
+      uint64_t lines = 0;
+      while (batch.size() < max_batch_bytes && ring_.try_pop(record)) {
+        now_formatter.append(batch, std::chrono::system_clock::now());
+        format(batch, record, timestamp_formatter);
+        lines++;
+      }
+      if (!batch.empty()) {
+        {
+          std::lock_guard<std::mutex> lock(logging::mutex());
+          auto &output = logging::console();
+          output.write(batch.data(),
+                       static_cast<std::streamsize>(batch.size()));
+          output.flush();
+        }
+        printed_.fetch_add(lines, std::memory_order_relaxed);
+        batch.clear();
+        continue;
+      }
+      if (stopped) {
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  void format(std::string &output, const Record &record,
+              logging::TimestampFormatter &timestamp_formatter) const {
+    output += " consumer[";
+    append_number(output, record.consumer_index);
+    output += "] message topic=";
+    output += topic_;
+    output += " partition=";
+    append_number(output, record.partition);
+    output += " offset=";
+    append_number(output, record.offset);
+    output += " timestamp=";
+    if (record.timestamp_ms < 0 ||
+        record.timestamp_type == RD_KAFKA_TIMESTAMP_NOT_AVAILABLE) {
+      output += "not available\n";
+      return;
+    }
+    timestamp_formatter.append(output,
+                               std::chrono::system_clock::time_point(
+                                   std::chrono::milliseconds(
+                                       record.timestamp_ms)));
+    output += record.timestamp_type == RD_KAFKA_TIMESTAMP_CREATE_TIME
+                  ? " (create_time)\n"
+                  : " (log_append_time)\n";
+  }
+
+  template <typename T>
+  static void append_number(std::string &output, T value) {
+    char digits[24];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    output.append(digits, result.ptr);
+  }
+};
@@ -0,0 +1,427 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <librdkafka/rdkafka.h>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Export consumed messages to a file or the standard output. Consumer threads
+// frame messages into their own buffers, which are handed to a writer thread
+// that writes them with writev(), so the poll loops only wait when the disk
+// falls behind by more than `max_buffers` buffers.
+class MessageSink final {
+public:
+  enum class Format {
+    // The value followed by a newline
+    Raw,
+    // The key and the value, each prefixed by its length as a big-endian
+    // int32, which is -1 for null
+    LengthPrefixed,
+    // A JSON object per line with the topic, partition, offset, timestamp, key
+    // and value
+    JsonLines
+  };
+
+  static Format parse_format(const std::string &name) {
+    if (name == "raw") {
+      return Format::Raw;
+    } else if (name == "binary") {
+      return Format::LengthPrefixed;
+    } else if (name == "json") {
+      return Format::JsonLines;
+    }
+    throw std::invalid_argument("Unknown output format: " + name);
+  }
+
+  // The buffer of a consumer thread
+  class Writer final {
+  public:
+    explicit Writer(MessageSink &sink) : sink_(sink) {
+      buffer_.reserve(buffer_size + 4096);
+    }
+
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    ~Writer() {
+      try {
+        flush();
+      } catch (const std::exception &) {
+        // The error is reported by MessageSink::close()
+      }
+    }
+
+    void write(const rd_kafka_message_t *message) {
+      switch (sink_.format_) {
+      case Format::Raw:
+        append(message->payload, message->len);
+        buffer_.push_back('\n');
+        break;
+      case Format::LengthPrefixed:
+        append_length_prefixed(message->key, message->key_len);
+        append_length_prefixed(message->payload, message->len);
+        break;
+      case Format::JsonLines:
+        append_json(message);
+        break;
+      }
+      if (buffer_.size() >= buffer_size) {
+        flush();
+      }
+    }
+
+    // Hand the buffered messages to the writer thread if they have been
+    // buffered for a while, so that a slow topic is still exported promptly
+    void flush_if_stale() {
+      if (!buffer_.empty() &&
+          std::chrono::steady_clock::now() - first_write_ > max_delay) {
+        flush();
+      }
+    }
+
+    void flush() {
+      if (buffer_.empty()) {
+        return;
+      }
+      buffer_ = sink_.submit(std::move(buffer_));
+      first_write_ = std::chrono::steady_clock::time_point{};
+    }
+
+  private:
+    friend class MessageSink;
+
+    static constexpr size_t buffer_size = 1024 * 1024;
+    static constexpr auto max_delay = std::chrono::milliseconds(100);
+
+    MessageSink &sink_;
+    std::vector<char> buffer_;
+    std::chrono::steady_clock::time_point first_write_;
+
+    void mark_first_write() {
+      if (buffer_.empty()) {
+        first_write_ = std::chrono::steady_clock::now();
+      }
+    }
+
+    void append(const void *data, size_t size) {
+      mark_first_write();
+      const auto *begin = static_cast<const char *>(data);
+      buffer_.insert(buffer_.end(), begin, begin + size);
+    }
+
+    void append_length_prefixed(const void *data, size_t size) {
+      const auto length =
+          data == nullptr ? uint32_t{0xffffffff} : static_cast<uint32_t>(size);
+      const char prefix[] = {static_cast<char>(length >> 24),
+                             static_cast<char>(length >> 16),
+                             static_cast<char>(length >> 8),
+                             static_cast<char>(length)};
+      append(prefix, sizeof(prefix));
+      if (data != nullptr) {
+        append(data, size);
+      }
+    }
+
+    template <typename T> void append_number(T value) {
+      char digits[24];
+      const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+      append(digits, static_cast<size_t>(result.ptr - digits));
+    }
+
+    void append_literal(const char *literal) {
+      append(literal, std::strlen(literal));
+    }
+
+    void append_json_string(const void *data, size_t size) {
+      if (data == nullptr) {
+        append_literal("null");
+        return;
+      }
+      static constexpr char hex[] = "0123456789abcdef";
+      buffer_.push_back('"');
+      const auto *bytes = static_cast<const unsigned char *>(data);
+      for (size_t i = 0; i < size; i++) {
+        const auto c = bytes[i];
+        if (c == '"' || c == '\\') {
+          buffer_.push_back('\\');
+          buffer_.push_back(static_cast<char>(c));
+        } else if (c >= 0x20 && c < 0x7f) {
+          buffer_.push_back(static_cast<char>(c));
+        } else {
+          // Escape control characters and, since the payload is not
+          // necessarily UTF-8, all non-ASCII bytes
+          const char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4],
+                                  hex[c & 0xf]};
+          buffer_.insert(buffer_.end(), escaped, escaped + sizeof(escaped));
+        }
+      }
+      buffer_.push_back('"');
+    }
+
+    void append_json(const rd_kafka_message_t *message) {
+      append_literal("{\"topic\":");
+      const char *topic =
+          message->rkt != nullptr ? rd_kafka_topic_name(message->rkt) : nullptr;
+      append_json_string(topic, topic != nullptr ? std::strlen(topic) : 0);
+      append_literal(",\"partition\":");
+      append_number(message->partition);
+      append_literal(",\"offset\":");
+      append_number(message->offset);
+      append_literal(",\"timestamp\":");
+      append_number(rd_kafka_message_timestamp(message, nullptr));
+      append_literal(",\"key\":");
+      append_json_string(message->key, message->key_len);
+      append_literal(",\"value\":");
+      append_json_string(message->payload, message->len);
+      append_literal("}\n");
+    }
+  };
+
+  // `path` "-" means the standard output. A positive `segment_bytes` rolls the
+  // output over to "<path>.<index>" files of at most `segment_bytes` each,
+  // unless a single buffer is larger.
+  MessageSink(std::string path, Format format, uint64_t segment_bytes,
+              size_t max_buffers = 64)
+      : path_(std::move(path)), format_(format),
+        segment_bytes_(path_ == "-" ? 0 : segment_bytes),
+        max_buffers_(max_buffers) {
+    open_segment();
+    writer_thread_ = std::thread([this] { run(); });
+  }
+
+  MessageSink(const MessageSink &) = delete;
+  MessageSink &operator=(const MessageSink &) = delete;
+
+  ~MessageSink() {
+    try {
+      close();
+    } catch (const std::exception &) {
+    }
+  }
+
+  // Write the submitted buffers and close the output. Throw if any write
+  // failed.
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (closed_) {
+        return;
+      }
+      closed_ = true;
+    }
+    cv_.notify_all();
+    if (writer_thread_.joinable()) {
+      writer_thread_.join();
+    }
+    if (fd_ > STDERR_FILENO) {
+      ::close(fd_);
+    }
+    fd_ = -1;
+    if (!error_.empty()) {
+      throw std::runtime_error(error_);
+    }
+  }
+
+  uint64_t written_bytes() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return written_bytes_;
+  }
+
+  size_t files() const noexcept { return segment_index_; }
+
+  const std::string &path() const noexcept { return path_; }
+
+private:
+  const std::string path_;
+  const Format format_;
+  const uint64_t segment_bytes_;
+  const size_t max_buffers_;
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::vector<char>> pending_;
+  std::vector<std::vector<char>> free_buffers_;
+  // Buffers held by writers, queued or being written
+  size_t buffers_ = 0;
+  bool closed_ = false;
+  std::string error_;
+  uint64_t written_bytes_ = 0;
+
+  // Only accessed by the writer thread after the construction
+  int fd_ = -1;
+  size_t segment_index_ = 0;
+  uint64_t segment_size_ = 0;
+  std::thread writer_thread_;
+
+  // Queue a full buffer and return an empty one, waiting if too many buffers
+  // are queued
+  std::vector<char> submit(std::vector<char> buffer) {
+    std::unique_lock<std::mutex> lock(mu_);
+    if (!error_.empty()) {
+      throw std::runtime_error(error_);
+    }
+    pending_.emplace_back(std::move(buffer));
+    cv_.notify_all();
+    cv_.wait(lock, [this] {
+      return !free_buffers_.empty() || buffers_ < max_buffers_ ||
+             !error_.empty();
+    });
+    if (!free_buffers_.empty()) {
+      auto free_buffer = std::move(free_buffers_.back());
+      free_buffers_.pop_back();
+      return free_buffer;
+    }
+    buffers_++;
+    std::vector<char> new_buffer;
+    new_buffer.reserve(Writer::buffer_size + 4096);
+    return new_buffer;
+  }
+
+  void run() {
+    std::vector<std::vector<char>> batch;
+    std::vector<iovec> iov;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [this] { return !pending_.empty() || closed_; });
+        if (pending_.empty()) {
+          return;
+        }
+        // Write at most 64 buffers per writev() call
+        while (!pending_.empty() && batch.size() < 64) {
+          batch.emplace_back(std::move(pending_.front()));
+          pending_.pop_front();
+        }
+      }
+
+      std::string error;
+      uint64_t written = 0;
+      try {
+        written = write_batch(batch, iov);
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+
+      std::lock_guard<std::mutex> lock(mu_);
+      written_bytes_ += written;
+      if (!error.empty() && error_.empty()) {
+        error_ = std::move(error);
+      }
+      for (auto &&buffer : batch) {
+        buffer.clear();
+        free_buffers_.emplace_back(std::move(buffer));
+      }
+      batch.clear();
+      cv_.notify_all();
+    }
+  }
+
+  // Write the buffers, rolling over to a new segment between buffers
+  uint64_t write_batch(const std::vector<std::vector<char>> &batch,
+                       std::vector<iovec> &iov) {
+    uint64_t written = 0;
+    size_t i = 0;
+    while (i < batch.size()) {
+      iov.clear();
+      uint64_t size = 0;
+      for (; i < batch.size(); i++) {
+        const auto &buffer = batch[i];
+        if (segment_bytes_ > 0 && segment_size_ + size > 0 &&
+            segment_size_ + size + buffer.size() > segment_bytes_) {
+          break;
+        }
+        iov.push_back(iovec{const_cast<char *>(buffer.data()), buffer.size()});
+        size += buffer.size();
+      }
+      if (iov.empty()) {
+        open_segment();
+        continue;
+      }
+      write_all(iov);
+      segment_size_ += size;
+      written += size;
+    }
+    return written;
+  }
+
+  void write_all(std::vector<iovec> &iov) {
+    auto *it = iov.data();
+    auto count = static_cast<int>(iov.size());
+    while (count > 0) {
+      const auto n = ::writev(fd_, it, count);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Failed to write " + current_path() + ": " +
+                                 std::strerror(errno));
+      }
+      auto remaining = static_cast<size_t>(n);
+      while (count > 0 && remaining >= it->iov_len) {
+        remaining -= it->iov_len;
+        it++;
+        count--;
+      }
+      if (count > 0) {
+        it->iov_base = static_cast<char *>(it->iov_base) + remaining;
+        it->iov_len -= remaining;
+      }
+    }
+  }
+
+  std::string current_path() const {
+    if (segment_bytes_ == 0) {
+      return path_;
+    }
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), ".%06zu", segment_index_ - 1);
+    return path_ + suffix;
+  }
+
+  void open_segment() {
+    if (path_ == "-") {
+      fd_ = STDOUT_FILENO;
+      segment_index_ = 1;
+      return;
+    }
+    if (fd_ > STDERR_FILENO) {
+      ::close(fd_);
+    }
+    segment_index_++;
+    segment_size_ = 0;
+    fd_ = ::open(current_path().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("Failed to open " + current_path() + ": " +
+                               std::strerror(errno));
+    }
+  }
+};
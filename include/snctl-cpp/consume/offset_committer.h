@@ -0,0 +1,298 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/latency_histogram.h"
+#include "snctl-cpp/logging.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <librdkafka/rdkafka.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+// Commit the stored offsets of a consumer every N messages or every T
+// milliseconds, either with blocking rd_kafka_commit() calls or with
+// rd_kafka_commit_queue() calls whose results are served by poll(). Failed
+// commits are retried up to 3 times if the error is retriable, and blocking
+// commits back off for `retry_backoff` before each retry.
+//
+// The committer is used by a single consumer thread, which must disable
+// `enable.auto.commit`.
+class OffsetCommitter final {
+public:
+  enum class Mode { Auto, Sync, Async };
+
+  // When to commit, either `messages` or `interval` is 0
+  struct Cadence {
+    uint64_t messages = 0;
+    std::chrono::milliseconds interval{0};
+  };
+
+  struct Result {
+    uint64_t commits = 0;
+    uint64_t failures = 0;
+    uint64_t retries = 0;
+  };
+
+  static Mode parse_mode(const std::string &name) {
+    if (name == "auto") {
+      return Mode::Auto;
+    } else if (name == "sync") {
+      return Mode::Sync;
+    } else if (name == "async") {
+      return Mode::Async;
+    }
+    throw std::invalid_argument("Unknown commit mode: " + name);
+  }
+
+  // Parse N messages, "<T>ms" or "<T>s"
+  static Cadence parse_cadence(const std::string &value) {
+    auto fail = [&value]() -> Cadence {
+      throw std::invalid_argument(
+          "Invalid commit cadence: " + value +
+          ", expected a number of messages or a duration like 500ms or 5s");
+    };
+    size_t end = 0;
+    long long number = 0;
+    try {
+      number = std::stoll(value, &end);
+    } catch (const std::exception &) {
+      return fail();
+    }
+    if (number <= 0) {
+      return fail();
+    }
+    const auto unit = value.substr(end);
+    Cadence cadence;
+    if (unit.empty()) {
+      cadence.messages = static_cast<uint64_t>(number);
+    } else if (unit == "ms") {
+      cadence.interval = std::chrono::milliseconds(number);
+    } else if (unit == "s") {
+      cadence.interval = std::chrono::seconds(number);
+    } else {
+      return fail();
+    }
+    return cadence;
+  }
+
+  // `queue` is only used in async mode, where it receives the commit results
+  OffsetCommitter(rd_kafka_t *rk, rd_kafka_queue_t *queue, Mode mode,
+                  Cadence cadence, LatencyRecorder &latency)
+      : rk_(rk), queue_(queue), mode_(mode), cadence_(cadence),
+        latency_(latency), last_commit_(std::chrono::steady_clock::now()) {
+    if (mode_ == Mode::Async && queue_ == nullptr) {
+      throw std::invalid_argument("Async commits require a queue");
+    }
+  }
+
+  OffsetCommitter(const OffsetCommitter &) = delete;
+  OffsetCommitter &operator=(const OffsetCommitter &) = delete;
+
+  // The commits still pending, which finish() gave up on, are detached from
+  // the committer. Their callbacks free them if the queue is ever served again,
+  // otherwise they leak with the queue.
+  ~OffsetCommitter() {
+    for (auto *pending : pending_) {
+      pending->committer = nullptr;
+    }
+  }
+
+  // Count the consumed messages and commit if it's due
+  void on_consumed(uint64_t messages) {
+    if (mode_ == Mode::Auto) {
+      return;
+    }
+    uncommitted_ += messages;
+    if (uncommitted_ == 0) {
+      return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (cadence_.messages > 0 ? uncommitted_ < cadence_.messages
+                              : now - last_commit_ < cadence_.interval) {
+      return;
+    }
+    uncommitted_ = 0;
+    last_commit_ = now;
+    if (mode_ == Mode::Sync) {
+      commit_sync();
+    } else {
+      commit_async(nullptr, now, 0);
+    }
+  }
+
+  // Serve the results of async commits
+  void poll() {
+    if (!pending_.empty()) {
+      rd_kafka_queue_poll_callback(queue_, 0);
+    }
+  }
+
+  // Commit the remaining offsets and wait up to `timeout_ms` for the pending
+  // async commits, which are counted as failures if they don't complete
+  void finish(int timeout_ms) {
+    if (mode_ == Mode::Auto) {
+      return;
+    }
+    if (uncommitted_ > 0) {
+      uncommitted_ = 0;
+      commit_sync();
+    }
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(timeout_ms);
+    while (!pending_.empty() && std::chrono::steady_clock::now() < deadline) {
+      rd_kafka_queue_poll_callback(queue_, 100);
+    }
+    if (!pending_.empty()) {
+      result_.failures += pending_.size();
+      logging::err() << "Gave up waiting for " << pending_.size()
+                     << " async commit" << (pending_.size() == 1 ? "" : "s")
+                     << " after " << timeout_ms << " ms";
+    }
+  }
+
+  // Return the results since the last call
+  Result take_result() noexcept {
+    const auto result = result_;
+    result_ = {};
+    return result;
+  }
+
+private:
+  static constexpr int max_retries = 3;
+  // The default `retry.backoff.ms` of librdkafka
+  static constexpr std::chrono::milliseconds retry_backoff{100};
+
+  // Owned by the commit callback, which frees it
+  struct PendingCommit {
+    // Null once the committer is destroyed
+    OffsetCommitter *committer;
+    std::chrono::steady_clock::time_point start;
+    int attempt;
+  };
+
+  rd_kafka_t *const rk_;
+  rd_kafka_queue_t *const queue_;
+  const Mode mode_;
+  const Cadence cadence_;
+  LatencyRecorder &latency_;
+  uint64_t uncommitted_ = 0;
+  std::chrono::steady_clock::time_point last_commit_;
+  std::unordered_set<PendingCommit *> pending_;
+  Result result_;
+
+  static bool is_retriable(rd_kafka_resp_err_t err) noexcept {
+    switch (err) {
+    case RD_KAFKA_RESP_ERR__TIMED_OUT:
+    case RD_KAFKA_RESP_ERR__TRANSPORT:
+    case RD_KAFKA_RESP_ERR__WAIT_COORD:
+    case RD_KAFKA_RESP_ERR_REQUEST_TIMED_OUT:
+    case RD_KAFKA_RESP_ERR_COORDINATOR_LOAD_IN_PROGRESS:
+    case RD_KAFKA_RESP_ERR_COORDINATOR_NOT_AVAILABLE:
+    case RD_KAFKA_RESP_ERR_NOT_COORDINATOR:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // The error of the whole commit or of the first failed partition
+  static rd_kafka_resp_err_t
+  commit_error(rd_kafka_resp_err_t err,
+               const rd_kafka_topic_partition_list_t *offsets) noexcept {
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR || offsets == nullptr) {
+      return err;
+    }
+    for (int i = 0; i < offsets->cnt; i++) {
+      if (offsets->elems[i].err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        return offsets->elems[i].err;
+      }
+    }
+    return err;
+  }
+
+  void commit_sync() {
+    const auto start = std::chrono::steady_clock::now();
+    for (int attempt = 0;; attempt++) {
+      const auto err = rd_kafka_commit(rk_, nullptr, 0);
+      if (attempt < max_retries && is_retriable(err)) {
+        // E.g. a coordinator that is still loading, which rarely clears up
+        // immediately
+        result_.retries++;
+        std::this_thread::sleep_for(retry_backoff);
+        continue;
+      }
+      on_result(err, start);
+      return;
+    }
+  }
+
+  // Commit `offsets`, or the stored offsets of the assignment if it's null
+  void commit_async(const rd_kafka_topic_partition_list_t *offsets,
+                    std::chrono::steady_clock::time_point start, int attempt) {
+    auto pending = std::make_unique<PendingCommit>(
+        PendingCommit{this, start, attempt});
+    const auto err = rd_kafka_commit_queue(rk_, offsets, queue_, &on_commit,
+                                           pending.get());
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+      on_result(err, start);
+      return;
+    }
+    pending_.emplace(pending.release());
+  }
+
+  static void on_commit(rd_kafka_t *, rd_kafka_resp_err_t err,
+                        rd_kafka_topic_partition_list_t *offsets,
+                        void *opaque) {
+    std::unique_ptr<PendingCommit> pending(
+        static_cast<PendingCommit *>(opaque));
+    if (pending->committer == nullptr) {
+      return;
+    }
+    auto &committer = *pending->committer;
+    committer.pending_.erase(pending.get());
+    err = commit_error(err, offsets);
+    if (pending->attempt < max_retries && is_retriable(err)) {
+      committer.result_.retries++;
+      committer.commit_async(offsets, pending->start, pending->attempt + 1);
+      return;
+    }
+    committer.on_result(err, pending->start);
+  }
+
+  void on_result(rd_kafka_resp_err_t err,
+                 std::chrono::steady_clock::time_point start) {
+    if (err == RD_KAFKA_RESP_ERR__NO_OFFSET) {
+      // Nothing new to commit
+      return;
+    }
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+      result_.failures++;
+      logging::err() << "Failed to commit offsets: " << rd_kafka_err2str(err);
+      return;
+    }
+    result_.commits++;
+    latency_.record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count()));
+  }
+};
@@ -0,0 +1,142 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/topic_metadata.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <librdkafka/rdkafka.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// The consumed messages and bytes of each partition, the offset to consume next
+// and the last known high watermark, counted by a single consumer thread. Like
+// ShardedCounters, each increment is a relaxed load and store, and the reporter
+// merges the counters of all threads, since a partition can move between
+// consumers.
+class PartitionCounters final {
+public:
+  struct Totals {
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    // -1 if no message was consumed
+    int64_t next_offset = -1;
+    // -1 if unknown
+    int64_t high_watermark = -1;
+  };
+
+  explicit PartitionCounters(size_t partitions)
+      : size_(partitions), slots_(std::make_unique<Slot[]>(partitions)) {}
+
+  PartitionCounters(const PartitionCounters &) = delete;
+  PartitionCounters &operator=(const PartitionCounters &) = delete;
+
+  // Partitions created after the start are ignored
+  void add(int32_t partition, uint64_t bytes, int64_t offset) noexcept {
+    if (partition < 0 || static_cast<size_t>(partition) >= size_) {
+      return;
+    }
+    auto &slot = slots_[partition];
+    slot.messages.store(slot.messages.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+    slot.bytes.store(slot.bytes.load(std::memory_order_relaxed) + bytes,
+                     std::memory_order_relaxed);
+    slot.next_offset.store(offset + 1, std::memory_order_relaxed);
+  }
+
+  // Record the high watermarks that librdkafka cached from the fetch responses
+  // of the partitions consumed by `rk`. Unlike
+  // rd_kafka_query_watermark_offsets(), it never sends a request, so it's cheap
+  // enough to call periodically from the consumer thread.
+  void refresh_high_watermarks(rd_kafka_t *rk,
+                               const std::string &topic) noexcept {
+    for (size_t i = 0; i < size_; i++) {
+      auto &slot = slots_[i];
+      if (slot.next_offset.load(std::memory_order_relaxed) < 0) {
+        continue;
+      }
+      int64_t low = 0;
+      int64_t high = RD_KAFKA_OFFSET_INVALID;
+      if (rd_kafka_get_watermark_offsets(rk, topic.c_str(),
+                                         static_cast<int32_t>(i), &low,
+                                         &high) == RD_KAFKA_RESP_ERR_NO_ERROR &&
+          high >= 0) {
+        slot.high_watermark.store(high, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  size_t size() const noexcept { return size_; }
+
+  // Add the counters of this thread into `totals`, which has `size()` entries
+  void merge_into(std::vector<Totals> &totals) const noexcept {
+    for (size_t i = 0; i < size_; i++) {
+      const auto &slot = slots_[i];
+      auto &total = totals[i];
+      total.messages += slot.messages.load(std::memory_order_relaxed);
+      total.bytes += slot.bytes.load(std::memory_order_relaxed);
+      total.next_offset = std::max(
+          total.next_offset, slot.next_offset.load(std::memory_order_relaxed));
+      total.high_watermark =
+          std::max(total.high_watermark,
+                   slot.high_watermark.load(std::memory_order_relaxed));
+    }
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> next_offset{-1};
+    std::atomic<int64_t> high_watermark{-1};
+  };
+
+  const size_t size_;
+  std::unique_ptr<Slot[]> slots_;
+};
+
+inline std::vector<PartitionCounters::Totals> merge_partition_counters(
+    const std::vector<std::unique_ptr<PartitionCounters>> &counters,
+    size_t partitions) {
+  std::vector<PartitionCounters::Totals> totals(partitions);
+  for (auto &&thread_counters : counters) {
+    thread_counters->merge_into(totals);
+  }
+  return totals;
+}
+
+// Query the high watermark of each partition from its leader, -1 if the query
+// failed
+inline std::vector<int64_t>
+query_high_watermarks(rd_kafka_t *rk, const std::string &topic,
+                      const std::vector<int32_t> &partitions, int timeout_ms) {
+  std::vector<int64_t> high_watermarks(partitions.size(), -1);
+  for (size_t i = 0; i < partitions.size(); i++) {
+    int64_t low = 0;
+    int64_t high = 0;
+    if (rd_kafka_query_watermark_offsets(rk, topic.c_str(), partitions[i],
+                                         &low, &high, timeout_ms) ==
+        RD_KAFKA_RESP_ERR_NO_ERROR) {
+      high_watermarks[i] = high;
+    }
+  }
+  return high_watermarks;
+}
@@ -0,0 +1,134 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/kafka_client.h"
+#include "snctl-cpp/latency_histogram.h"
+#include "snctl-cpp/logging.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Aggregate the rebalance timings of all consumers, separately for the eager
+// and the cooperative protocol. Rebalances are rare, so a mutex is fine.
+class RebalanceSummary final {
+public:
+  explicit RebalanceSummary(size_t consumers) : consumers_(consumers) {}
+
+  void add(int consumer_index, const KafkaClient::RebalanceEvent &event) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto &protocol = protocols_[event.cooperative ? 1 : 0];
+    protocol.callbacks++;
+    protocol.sync_time.record(to_us(event.sync_time));
+    if (event.since_revoke.has_value()) {
+      protocol.rebalance_time.record(to_us(*event.since_revoke));
+    }
+    auto &consumer = consumers_[consumer_index];
+    if (event.unassigned_time.has_value()) {
+      protocol.unassigned_time.record(to_us(*event.unassigned_time));
+      consumer.unassigned_periods++;
+      consumer.unassigned_time += *event.unassigned_time;
+    }
+    consumer.callbacks++;
+  }
+
+  // Describe the timings of a single callback
+  static std::string describe(const KafkaClient::RebalanceEvent &event) {
+    std::ostringstream oss;
+    oss << (event.cooperative ? "cooperative" : "eager")
+        << ", assignment call: " << to_ms(event.sync_time) << " ms";
+    if (event.since_revoke.has_value()) {
+      oss << ", since revoke: " << to_ms(*event.since_revoke) << " ms";
+    }
+    if (event.unassigned_time.has_value()) {
+      oss << ", without partitions for " << to_ms(*event.unassigned_time)
+          << " ms";
+    }
+    return oss.str();
+  }
+
+  void report() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    static const char *names[] = {"Eager", "Cooperative"};
+    bool any = false;
+    for (size_t i = 0; i < 2; i++) {
+      const auto &protocol = protocols_[i];
+      if (protocol.callbacks == 0) {
+        continue;
+      }
+      any = true;
+      logging::out() << names[i] << " rebalance callbacks: "
+                     << protocol.callbacks << ", assignment call "
+                     << protocol.sync_time.format_percentiles();
+      if (protocol.rebalance_time.count() > 0) {
+        logging::out() << names[i] << " revoke to assign of "
+                       << protocol.rebalance_time.count()
+                       << " rebalances: "
+                       << protocol.rebalance_time.format_percentiles();
+      }
+      if (protocol.unassigned_time.count() > 0) {
+        logging::out() << names[i] << " periods without partitions ("
+                       << protocol.unassigned_time.count() << "): "
+                       << protocol.unassigned_time.format_percentiles();
+      }
+    }
+    if (!any) {
+      return;
+    }
+    logging::out()
+        << "| consumer | rebalance callbacks | periods without partitions | "
+           "time without partitions |";
+    for (size_t i = 0; i < consumers_.size(); i++) {
+      const auto &consumer = consumers_[i];
+      logging::out() << "| " << i << " | " << consumer.callbacks << " | "
+                     << consumer.unassigned_periods << " | "
+                     << to_ms(consumer.unassigned_time) << " ms |";
+    }
+  }
+
+private:
+  struct Protocol {
+    uint64_t callbacks = 0;
+    LatencyHistogram sync_time;
+    LatencyHistogram rebalance_time;
+    LatencyHistogram unassigned_time;
+  };
+
+  struct Consumer {
+    uint64_t callbacks = 0;
+    uint64_t unassigned_periods = 0;
+    std::chrono::microseconds unassigned_time{0};
+  };
+
+  mutable std::mutex mu_;
+  // Indexed by whether the protocol is cooperative
+  Protocol protocols_[2];
+  std::vector<Consumer> consumers_;
+
+  static uint64_t to_us(std::chrono::microseconds duration) noexcept {
+    return static_cast<uint64_t>(duration.count());
+  }
+
+  static double to_ms(std::chrono::microseconds duration) noexcept {
+    return static_cast<double>(duration.count()) / 1000.0;
+  }
+};
@@ -0,0 +1,316 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// A sliding window of received sequences, one bit per sequence in a ring of
+// `Bits` bits that covers [base, base + Bits).
+template <size_t Bits> class SequenceBitmap final {
+public:
+  static_assert(Bits % 64 == 0, "Bits must be a multiple of 64");
+  static constexpr size_t word_count = Bits / 64;
+
+  // Start the window so that `sequence` and up to half a window of earlier
+  // sequences are covered
+  void reset(uint64_t sequence) noexcept {
+    words_.fill(0);
+    const auto start = sequence - std::min<uint64_t>(sequence, Bits / 2);
+    base_ = start - start % 64;
+  }
+
+  uint64_t base() const noexcept { return base_; }
+
+  bool covers(uint64_t sequence) const noexcept {
+    return sequence >= base_ && sequence - base_ < Bits;
+  }
+
+  bool test(uint64_t sequence) const noexcept {
+    return (word(sequence) >> (sequence % 64)) & 1;
+  }
+
+  void set(uint64_t sequence) noexcept {
+    word(sequence) |= uint64_t{1} << (sequence % 64);
+  }
+
+  // Slide the window forward until it covers `sequence` and return how many
+  // sequences not below `floor` left the window without being set
+  uint64_t advance_to(uint64_t sequence, uint64_t floor = 0) noexcept {
+    uint64_t unset = 0;
+    if (sequence < base_ + Bits) {
+      return unset;
+    }
+    const auto target_base = (sequence - Bits + 64) - (sequence - Bits) % 64;
+    for (size_t i = 0; i < word_count && base_ < target_base; i++) {
+      auto &value = word(base_);
+      if (base_ + 64 > floor) {
+        // Treat the sequences below `floor` as set
+        const auto below = floor > base_ ? floor - base_ : 0;
+        const auto mask = below == 0 ? 0 : ~uint64_t{0} >> (64 - below);
+        unset += 64 - static_cast<uint64_t>(
+                          std::bitset<64>(value | mask).count());
+      }
+      value = 0;
+      base_ += 64;
+    }
+    // The whole window was retired, the sequences beyond it were never set
+    if (target_base > std::max(base_, floor)) {
+      unset += target_base - std::max(base_, floor);
+    }
+    base_ = target_base;
+    return unset;
+  }
+
+  // The unset sequences in [max(base, begin), end)
+  uint64_t count_unset(uint64_t begin, uint64_t end) const noexcept {
+    uint64_t unset = 0;
+    for (auto sequence = std::max(base_, begin);
+         sequence < end && covers(sequence); sequence++) {
+      unset += test(sequence) ? 0 : 1;
+    }
+    return unset;
+  }
+
+private:
+  std::array<uint64_t, word_count> words_{};
+  uint64_t base_ = 0;
+
+  uint64_t &word(uint64_t sequence) noexcept {
+    return words_[(sequence / 64) % word_count];
+  }
+
+  uint64_t word(uint64_t sequence) const noexcept {
+    return words_[(sequence / 64) % word_count];
+  }
+};
+
+// Detect lost messages across all consumers. A producer's messages can be
+// spread over partitions that are read by different consumer threads, so the
+// sequences of each producer are merged into a shared window, and the
+// sequences that leave the window without being received are gaps.
+class SequenceVerifier final {
+public:
+  // 64 Ki sequences per producer, which is 8 KiB
+  using Window = SequenceBitmap<65536>;
+
+  struct Result {
+    uint64_t gaps = 0;
+    // Received after leaving the window, i.e. a gap that arrived late or an
+    // old duplicate
+    uint64_t late = 0;
+    // Already received, possibly by another consumer
+    uint64_t duplicates = 0;
+    // Behind sequences that were not received before, including the sequences
+    // below the lowest one received so far
+    uint64_t reordered = 0;
+  };
+
+  struct Received {
+    uint64_t sequence;
+    // Received after a higher sequence in the same partition, which is either
+    // a duplicate or an out-of-order message
+    bool behind;
+  };
+
+  class Producer final {
+  public:
+    // Merge the received sequences into the window
+    Result add(const std::vector<Received> &sequences) {
+      Result result;
+      std::lock_guard<std::mutex> lock(mu_);
+      for (auto &&[sequence, behind] : sequences) {
+        if (!started_) {
+          window_.reset(sequence);
+          lowest_ = sequence;
+          started_ = true;
+        }
+        if (sequence < window_.base()) {
+          result.late++;
+          continue;
+        }
+        result.gaps += window_.advance_to(sequence, lowest_);
+        if (window_.test(sequence)) {
+          result.duplicates++;
+          continue;
+        }
+        if (behind || sequence < lowest_) {
+          result.reordered++;
+        }
+        lowest_ = std::min(lowest_, sequence);
+        window_.set(sequence);
+        highest_ = std::max(highest_, sequence);
+      }
+      return result;
+    }
+
+    // The sequences in the window that are not received yet, which are gaps
+    // unless they are still in flight
+    uint64_t pending_gaps() const {
+      std::lock_guard<std::mutex> lock(mu_);
+      return started_ ? window_.count_unset(lowest_, highest_ + 1) : 0;
+    }
+
+  private:
+    mutable std::mutex mu_;
+    bool started_ = false;
+    // The consumers can start in the middle of the producer's sequences, e.g.
+    // from the latest or committed offsets, so only the unset sequences from
+    // the lowest received one are gaps
+    uint64_t lowest_ = 0;
+    uint64_t highest_ = 0;
+    Window window_;
+  };
+
+  Producer &producer(int index) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto &producer = producers_[index];
+    if (!producer) {
+      producer = std::make_unique<Producer>();
+    }
+    return *producer;
+  }
+
+  uint64_t pending_gaps() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    uint64_t gaps = 0;
+    for (auto &&[index, producer] : producers_) {
+      gaps += producer->pending_gaps();
+    }
+    return gaps;
+  }
+
+private:
+  mutable std::mutex mu_;
+  std::unordered_map<int, std::unique_ptr<Producer>> producers_;
+};
+
+// The verification state of a consumer thread. Recent duplicates are detected
+// per (producer, partition) without any lock, while the received sequences are
+// handed to the shared SequenceVerifier in chunks. A sequence behind the
+// highest one of its partition, which the small per-partition window can't
+// tell apart, is classified by the shared window as a duplicate or an
+// out-of-order message.
+class SequenceChecker final {
+public:
+  struct Result {
+    uint64_t gaps = 0;
+    uint64_t late = 0;
+    uint64_t duplicates = 0;
+    uint64_t reordered = 0;
+  };
+
+  explicit SequenceChecker(SequenceVerifier &verifier) : verifier_(verifier) {}
+
+  void check(int producer_index, int32_t partition, uint64_t sequence) {
+    auto &stream = streams_[stream_key(producer_index, partition)];
+    bool behind = false;
+    if (!stream.started) {
+      stream.window.reset(sequence);
+      stream.highest = sequence;
+      stream.started = true;
+    } else if (sequence > stream.highest) {
+      stream.window.advance_to(sequence);
+      stream.highest = sequence;
+    } else if (stream.window.covers(sequence) &&
+               stream.window.test(sequence)) {
+      result_.duplicates++;
+      return;
+    } else {
+      behind = true;
+    }
+    if (stream.window.covers(sequence)) {
+      stream.window.set(sequence);
+    }
+
+    auto &pending = pending_[producer_index];
+    if (pending.producer == nullptr) {
+      pending.producer = &verifier_.producer(producer_index);
+    }
+    pending.sequences.push_back({sequence, behind});
+    if (pending.sequences.size() >= flush_size) {
+      flush_pending(pending);
+    }
+  }
+
+  // Hand the pending sequences to the verifier if they are older than the
+  // flush interval, or unconditionally if `force` is true
+  void flush(bool force = false) {
+    const auto now = std::chrono::steady_clock::now();
+    if (!force && now - last_flush_ < flush_interval) {
+      return;
+    }
+    last_flush_ = now;
+    for (auto &&[index, pending] : pending_) {
+      flush_pending(pending);
+    }
+  }
+
+  // Return the results since the last call
+  Result take_result() noexcept {
+    const auto result = result_;
+    result_ = {};
+    return result;
+  }
+
+private:
+  static constexpr size_t flush_size = 256;
+  static constexpr auto flush_interval = std::chrono::milliseconds(100);
+
+  struct Stream {
+    bool started = false;
+    uint64_t highest = 0;
+    // 1 Ki sequences, which is 128 bytes
+    SequenceBitmap<1024> window;
+  };
+
+  struct Pending {
+    SequenceVerifier::Producer *producer = nullptr;
+    std::vector<SequenceVerifier::Received> sequences;
+  };
+
+  SequenceVerifier &verifier_;
+  std::unordered_map<uint64_t, Stream> streams_;
+  std::unordered_map<int, Pending> pending_;
+  std::chrono::steady_clock::time_point last_flush_;
+  Result result_;
+
+  static uint64_t stream_key(int producer_index, int32_t partition) noexcept {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(producer_index))
+            << 32) |
+           static_cast<uint32_t>(partition);
+  }
+
+  void flush_pending(Pending &pending) {
+    if (pending.sequences.empty()) {
+      return;
+    }
+    const auto result = pending.producer->add(pending.sequences);
+    result_.gaps += result.gaps;
+    result_.late += result.late;
+    result_.duplicates += result.duplicates;
+    result_.reordered += result.reordered;
+    pending.sequences.clear();
+  }
+};
@@ -0,0 +1,149 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <librdkafka/rdkafka.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A fixed split of partitions across the consumers, which are assigned with
+// rd_kafka_assign() instead of joining a group. Like the range assignor, each
+// consumer gets a contiguous block and the first consumers get one more
+// partition when they cannot be split evenly.
+class StaticAssignment final {
+public:
+  enum class Mode { Group, Static };
+
+  static Mode parse_mode(const std::string &name) {
+    if (name == "group") {
+      return Mode::Group;
+    } else if (name == "static") {
+      return Mode::Static;
+    }
+    throw std::invalid_argument("Unknown assign mode: " + name);
+  }
+
+  // Parse a list of partitions and ranges like "0-15" or "0,2,4-7". An empty
+  // spec means all partitions.
+  static std::vector<int32_t> parse_partitions(const std::string &spec,
+                                               size_t partition_count) {
+    std::vector<int32_t> partitions;
+    if (spec.empty()) {
+      for (size_t i = 0; i < partition_count; i++) {
+        partitions.emplace_back(static_cast<int32_t>(i));
+      }
+      return partitions;
+    }
+
+    auto fail = [&spec]() {
+      throw std::invalid_argument("Invalid partitions: " + spec +
+                                  ", expected e.g. 0-15 or 0,2,4-7");
+    };
+    auto parse_number = [&fail, partition_count](const std::string &value) {
+      size_t end = 0;
+      long number = -1;
+      try {
+        number = std::stol(value, &end);
+      } catch (const std::exception &) {
+        fail();
+      }
+      if (end != value.size() || number < 0) {
+        fail();
+      }
+      if (static_cast<size_t>(number) >= partition_count) {
+        throw std::invalid_argument("Partition " + std::to_string(number) +
+                                    " does not exist, the topic has " +
+                                    std::to_string(partition_count) +
+                                    " partitions");
+      }
+      return static_cast<int32_t>(number);
+    };
+
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+      const auto dash = item.find('-');
+      const auto first = parse_number(item.substr(0, dash));
+      const auto last = dash == std::string::npos
+                            ? first
+                            : parse_number(item.substr(dash + 1));
+      if (last < first) {
+        fail();
+      }
+      for (auto partition = first; partition <= last; partition++) {
+        partitions.emplace_back(partition);
+      }
+    }
+    if (partitions.empty()) {
+      fail();
+    }
+    std::sort(partitions.begin(), partitions.end());
+    partitions.erase(std::unique(partitions.begin(), partitions.end()),
+                     partitions.end());
+    return partitions;
+  }
+
+  StaticAssignment(std::vector<int32_t> partitions, size_t consumers)
+      : partitions_(std::move(partitions)), consumers_(consumers) {
+    if (consumers_ == 0 || partitions_.size() < consumers_) {
+      throw std::invalid_argument(
+          "A static assignment of " + std::to_string(partitions_.size()) +
+          " partitions cannot be split across " + std::to_string(consumers_) +
+          " consumers");
+    }
+  }
+
+  size_t size() const noexcept { return partitions_.size(); }
+
+  const std::vector<int32_t> &partitions() const noexcept {
+    return partitions_;
+  }
+
+  std::vector<int32_t> partitions_of(size_t consumer_index) const {
+    const auto base = partitions_.size() / consumers_;
+    const auto extra = partitions_.size() % consumers_;
+    const auto begin =
+        consumer_index * base + std::min(consumer_index, extra);
+    const auto end = begin + base + (consumer_index < extra ? 1 : 0);
+    return {partitions_.begin() + begin, partitions_.begin() + end};
+  }
+
+  // Create the list of a consumer's partitions, which all start from `offset`
+  rd_kafka_topic_partition_list_t *make_list(const std::string &topic,
+                                             size_t consumer_index,
+                                             int64_t offset) const {
+    const auto partitions = partitions_of(consumer_index);
+    auto *list =
+        rd_kafka_topic_partition_list_new(static_cast<int>(partitions.size()));
+    if (list == nullptr) {
+      throw std::runtime_error("Failed to create the assignment list");
+    }
+    for (auto partition : partitions) {
+      rd_kafka_topic_partition_list_add(list, topic.c_str(), partition)
+          ->offset = offset;
+    }
+    return list;
+  }
+
+private:
+  const std::vector<int32_t> partitions_;
+  const size_t consumers_;
+};
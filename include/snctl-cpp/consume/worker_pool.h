@@ -0,0 +1,439 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/latency_histogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <librdkafka/rdkafka.h>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// The simulated processing time of a message: "<us>" for a fixed time,
+// "exp:<mean us>" for an exponential distribution or "uniform:<min>-<max>"
+class ProcessingCost final {
+public:
+  static ProcessingCost parse(const std::string &spec) {
+    auto fail = [&spec]() -> ProcessingCost {
+      throw std::invalid_argument(
+          "Invalid processing time: " + spec +
+          ", expected <us>, exp:<mean us> or uniform:<min us>-<max us>");
+    };
+    auto parse_number = [&fail](const std::string &value) {
+      size_t end = 0;
+      double number = 0;
+      try {
+        number = std::stod(value, &end);
+      } catch (const std::exception &) {
+        fail();
+      }
+      if (end != value.size() || !(number >= 0)) {
+        fail();
+      }
+      return number;
+    };
+
+    ProcessingCost cost;
+    if (spec.rfind("exp:", 0) == 0) {
+      cost.shape_ = Shape::Exponential;
+      cost.a_ = parse_number(spec.substr(4));
+    } else if (spec.rfind("uniform:", 0) == 0) {
+      const auto range = spec.substr(8);
+      const auto dash = range.find('-');
+      if (dash == std::string::npos) {
+        return fail();
+      }
+      cost.shape_ = Shape::Uniform;
+      cost.a_ = parse_number(range.substr(0, dash));
+      cost.b_ = parse_number(range.substr(dash + 1));
+      if (cost.b_ < cost.a_) {
+        return fail();
+      }
+    } else {
+      cost.a_ = parse_number(spec);
+    }
+    return cost;
+  }
+
+  bool is_zero() const noexcept {
+    return a_ == 0 && (shape_ != Shape::Uniform || b_ == 0);
+  }
+
+  uint32_t sample(std::mt19937_64 &rng) const {
+    double value = a_;
+    switch (shape_) {
+    case Shape::Fixed:
+      break;
+    case Shape::Exponential:
+      if (a_ > 0) {
+        value = std::exponential_distribution<double>(1.0 / a_)(rng);
+      }
+      break;
+    case Shape::Uniform:
+      value = std::uniform_real_distribution<double>(a_, b_)(rng);
+      break;
+    }
+    return static_cast<uint32_t>(std::min(std::llround(value), 1000000LL));
+  }
+
+private:
+  enum class Shape { Fixed, Exponential, Uniform };
+
+  Shape shape_ = Shape::Fixed;
+  double a_ = 0;
+  double b_ = 0;
+};
+
+// Process consumed messages on a pool of worker threads. Messages are sharded
+// by their ordering key, and each shard is a FIFO queue that at most one
+// worker drains at a time, so the messages of a key are processed in order.
+// Each worker has a deque of the shards that are ready to be drained, and an
+// idle worker steals ready shards from the other workers.
+//
+// The processing is simulated by spinning for the sampled processing time.
+class WorkerPool final {
+  struct Task {
+    std::chrono::steady_clock::time_point submitted;
+    uint32_t cost_us;
+  };
+
+public:
+  enum class OrderBy { Key, Partition };
+
+  struct Stats {
+    uint64_t processed = 0;
+    // Nanoseconds spent processing across all workers
+    uint64_t busy_ns = 0;
+    // The time between submitting and processing messages
+    LatencyHistogram wait;
+  };
+
+  static OrderBy parse_order_by(const std::string &name) {
+    if (name == "key") {
+      return OrderBy::Key;
+    } else if (name == "partition") {
+      return OrderBy::Partition;
+    }
+    throw std::invalid_argument("Unknown ordering: " + name);
+  }
+
+  // The submission state of a consumer thread, which buffers the messages of
+  // each poll and hands them to the pool in one flush() call
+  class Submitter final {
+  public:
+    explicit Submitter(WorkerPool &pool)
+        : pool_(pool), rng_(std::random_device{}()),
+          pending_(pool.shards_.size()) {}
+
+    Submitter(const Submitter &) = delete;
+    Submitter &operator=(const Submitter &) = delete;
+
+    ~Submitter() { flush(); }
+
+    void add(const rd_kafka_message_t *message) {
+      size_t hash;
+      if (pool_.order_by_ == OrderBy::Key && message->key != nullptr) {
+        hash = std::hash<std::string_view>{}(std::string_view(
+            static_cast<const char *>(message->key), message->key_len));
+      } else {
+        hash = std::hash<int32_t>{}(message->partition);
+      }
+      const auto shard = hash % pending_.size();
+      auto &tasks = pending_[shard];
+      if (tasks.empty()) {
+        dirty_.push_back(shard);
+      }
+      tasks.push_back(Task{std::chrono::steady_clock::now(),
+                           pool_.cost_.sample(rng_)});
+      pending_count_++;
+    }
+
+    // Submit the buffered messages, waiting while the pool is full
+    void flush() {
+      if (pending_count_ == 0) {
+        return;
+      }
+      pool_.wait_for_space(pending_count_);
+      for (auto shard : dirty_) {
+        pool_.submit(shard, pending_[shard]);
+        pending_[shard].clear();
+      }
+      dirty_.clear();
+      pending_count_ = 0;
+    }
+
+  private:
+    WorkerPool &pool_;
+    std::mt19937_64 rng_;
+    std::vector<std::vector<Task>> pending_;
+    std::vector<size_t> dirty_;
+    size_t pending_count_ = 0;
+  };
+
+  // Queue at most `max_queued` messages, after which consumers wait
+  WorkerPool(size_t workers, OrderBy order_by, ProcessingCost cost,
+             size_t max_queued)
+      : order_by_(order_by), cost_(cost), max_queued_(max_queued),
+        shards_(workers * shards_per_worker), workers_(workers) {
+    if (workers == 0) {
+      throw std::invalid_argument("The number of workers must be positive");
+    }
+    if (max_queued == 0) {
+      throw std::invalid_argument("The worker queue size must be positive");
+    }
+    for (size_t i = 0; i < workers; i++) {
+      workers_[i].thread = std::thread([this, i] { run(i); });
+    }
+  }
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  ~WorkerPool() { stop(); }
+
+  // Process the queued messages and stop the workers
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(idle_mu_);
+      stopping_ = true;
+    }
+    idle_cv_.notify_all();
+    for (auto &worker : workers_) {
+      if (worker.thread.joinable()) {
+        worker.thread.join();
+      }
+    }
+  }
+
+  size_t workers() const noexcept { return workers_.size(); }
+
+  uint64_t queued() const noexcept {
+    return queued_.load(std::memory_order_relaxed);
+  }
+
+  // The highest queue depth since the last call
+  uint64_t take_max_queued() noexcept {
+    return max_queued_seen_.exchange(queued(), std::memory_order_relaxed);
+  }
+
+  Stats stats() const {
+    Stats stats;
+    for (auto &&worker : workers_) {
+      stats.processed += worker.processed.load(std::memory_order_relaxed);
+      stats.busy_ns += worker.busy_ns.load(std::memory_order_relaxed);
+      worker.wait.snapshot_into(stats.wait);
+    }
+    return stats;
+  }
+
+private:
+  static constexpr size_t shards_per_worker = 8;
+  // Process at most this many messages of a shard before moving on, so that
+  // a hot key does not starve the other shards of the worker
+  static constexpr size_t max_tasks_per_turn = 64;
+
+  struct Shard {
+    std::mutex mu;
+    std::deque<Task> tasks;
+    // Whether the shard is in a ready deque or being drained
+    bool scheduled = false;
+  };
+
+  struct alignas(128) Worker {
+    std::mutex mu;
+    // The ready shards, taken from the front by the owner and stolen from the
+    // back by the others
+    std::deque<size_t> ready;
+    std::thread thread;
+    std::atomic<uint64_t> processed{0};
+    std::atomic<uint64_t> busy_ns{0};
+    LatencyRecorder wait;
+  };
+
+  const OrderBy order_by_;
+  const ProcessingCost cost_;
+  const size_t max_queued_;
+  std::vector<Shard> shards_;
+  std::vector<Worker> workers_;
+  std::atomic<uint64_t> queued_{0};
+  std::atomic<uint64_t> max_queued_seen_{0};
+
+  std::mutex idle_mu_;
+  std::condition_variable idle_cv_;
+  // The shards in all ready deques
+  std::atomic<size_t> ready_shards_{0};
+  bool stopping_ = false;
+
+  std::mutex space_mu_;
+  std::condition_variable space_cv_;
+  std::atomic<int> space_waiters_{0};
+
+  void wait_for_space(size_t count) {
+    // A batch larger than the whole queue is let through when it's empty
+    auto has_space = [this, count] {
+      const auto current = queued();
+      return current == 0 || current + count <= max_queued_;
+    };
+    if (has_space()) {
+      return;
+    }
+    space_waiters_.fetch_add(1);
+    {
+      std::unique_lock<std::mutex> lock(space_mu_);
+      space_cv_.wait(lock, has_space);
+    }
+    space_waiters_.fetch_sub(1);
+  }
+
+  void submit(size_t shard_index, const std::vector<Task> &tasks) {
+    const auto queued = queued_.fetch_add(tasks.size()) + tasks.size();
+    auto max = max_queued_seen_.load(std::memory_order_relaxed);
+    while (queued > max && !max_queued_seen_.compare_exchange_weak(
+                               max, queued, std::memory_order_relaxed)) {
+    }
+
+    auto &shard = shards_[shard_index];
+    bool schedule = false;
+    {
+      std::lock_guard<std::mutex> lock(shard.mu);
+      shard.tasks.insert(shard.tasks.end(), tasks.begin(), tasks.end());
+      if (!shard.scheduled) {
+        shard.scheduled = schedule = true;
+      }
+    }
+    if (schedule) {
+      make_ready(shard_index % workers_.size(), shard_index);
+    }
+  }
+
+  void make_ready(size_t worker_index, size_t shard_index) {
+    {
+      auto &worker = workers_[worker_index];
+      std::lock_guard<std::mutex> lock(worker.mu);
+      worker.ready.push_back(shard_index);
+    }
+    ready_shards_.fetch_add(1);
+    std::lock_guard<std::mutex> lock(idle_mu_);
+    idle_cv_.notify_one();
+  }
+
+  // Take a ready shard from the worker's own deque or steal one
+  bool take_shard(size_t worker_index, size_t &shard_index) {
+    for (size_t i = 0; i < workers_.size(); i++) {
+      auto &worker = workers_[(worker_index + i) % workers_.size()];
+      std::lock_guard<std::mutex> lock(worker.mu);
+      if (worker.ready.empty()) {
+        continue;
+      }
+      if (i == 0) {
+        shard_index = worker.ready.front();
+        worker.ready.pop_front();
+      } else {
+        shard_index = worker.ready.back();
+        worker.ready.pop_back();
+      }
+      ready_shards_.fetch_sub(1);
+      return true;
+    }
+    return false;
+  }
+
+  void run(size_t worker_index) {
+    auto &worker = workers_[worker_index];
+    std::vector<Task> tasks;
+    tasks.reserve(max_tasks_per_turn);
+    while (true) {
+      size_t shard_index = 0;
+      if (!take_shard(worker_index, shard_index)) {
+        std::unique_lock<std::mutex> lock(idle_mu_);
+        if (ready_shards_.load() == 0 && stopping_) {
+          return;
+        }
+        idle_cv_.wait_for(lock, std::chrono::milliseconds(100), [this] {
+          return ready_shards_.load() > 0 || stopping_;
+        });
+        continue;
+      }
+
+      auto &shard = shards_[shard_index];
+      {
+        std::lock_guard<std::mutex> lock(shard.mu);
+        const auto count = std::min(shard.tasks.size(), max_tasks_per_turn);
+        tasks.assign(shard.tasks.begin(), shard.tasks.begin() + count);
+        shard.tasks.erase(shard.tasks.begin(), shard.tasks.begin() + count);
+      }
+      process(worker, tasks);
+
+      bool reschedule = false;
+      {
+        std::lock_guard<std::mutex> lock(shard.mu);
+        if (shard.tasks.empty()) {
+          shard.scheduled = false;
+        } else {
+          reschedule = true;
+        }
+      }
+      if (reschedule) {
+        make_ready(worker_index, shard_index);
+      }
+    }
+  }
+
+  void process(Worker &worker, const std::vector<Task> &tasks) {
+    const auto start = std::chrono::steady_clock::now();
+    auto now = start;
+    for (auto &&task : tasks) {
+      worker.wait.record(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              now - task.submitted)
+              .count()));
+      const auto end = now + std::chrono::microseconds(task.cost_us);
+      // Spin rather than sleep to model CPU-bound work
+      do {
+        now = std::chrono::steady_clock::now();
+      } while (now < end);
+    }
+    worker.busy_ns.store(
+        worker.busy_ns.load(std::memory_order_relaxed) +
+            static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now -
+                                                                     start)
+                    .count()),
+        std::memory_order_relaxed);
+    worker.processed.store(worker.processed.load(std::memory_order_relaxed) +
+                               tasks.size(),
+                           std::memory_order_relaxed);
+    queued_.fetch_sub(tasks.size());
+    if (space_waiters_.load() > 0) {
+      std::lock_guard<std::mutex> lock(space_mu_);
+      space_cv_.notify_all();
+    }
+  }
+};
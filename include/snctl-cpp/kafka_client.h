@@ -16,31 +16,73 @@
 #pragma once
 
 #include "snctl-cpp/configs.h"
+#include "snctl-cpp/kafka_conf_template.h"
 #include "snctl-cpp/logging.h"
+#include "snctl-cpp/queue_events.h"
 
 #include <array>
+#include <chrono>
 #include <cstring>
 #include <fstream>
 #include <functional>
 #include <librdkafka/rdkafka.h>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <utility>
 
 class KafkaClient final {
 public:
+  // The timings of a rebalance callback of a consumer
+  struct RebalanceEvent {
+    bool cooperative = false;
+    // The time spent in the (incremental) assign or unassign call
+    std::chrono::microseconds sync_time{0};
+    // For the first assignment after a revocation or an error, the time since
+    // then, i.e. how long the rebalance took from this consumer's view
+    std::optional<std::chrono::microseconds> since_revoke;
+    // For an assignment that ends a period without partitions (not counting
+    // the initial join), the length of that period
+    std::optional<std::chrono::microseconds> unassigned_time;
+    // The number of partitions assigned after the callback
+    int partitions = 0;
+  };
+
   using DeliveryReportCallback =
       std::function<void(const rd_kafka_message_t *message)>;
-  using RebalanceCallback =
-      std::function<void(rd_kafka_t *rk, rd_kafka_resp_err_t err,
-                         const rd_kafka_topic_partition_list_t *partitions)>;
+  using RebalanceCallback = std::function<void(
+      rd_kafka_t *rk, rd_kafka_resp_err_t err,
+      const rd_kafka_topic_partition_list_t *partitions,
+      const RebalanceEvent &event)>;
+  // Called with the JSON statistics every `statistics.interval.ms`
+  using StatsCallback = std::function<void(const char *json, size_t len)>;
+  // Called with the partitions to assign before they are assigned, e.g. to set
+  // their start offsets
+  using AssignCallback =
+      std::function<void(rd_kafka_topic_partition_list_t *partitions)>;
 
   KafkaClient(rd_kafka_type_t type,
               const std::unordered_map<std::string, std::string> &configs,
               const LogConfigs &log_configs, bool with_queue = false,
               RebalanceCallback rebalance_callback = {},
-              DeliveryReportCallback delivery_report_callback = {})
+              DeliveryReportCallback delivery_report_callback = {},
+              StatsCallback stats_callback = {})
+      : KafkaClient(type, KafkaConfTemplate(configs), {}, log_configs,
+                    with_queue, std::move(rebalance_callback),
+                    std::move(delivery_report_callback),
+                    std::move(stats_callback)) {}
+
+  // Create the client from a copy of `conf_template` with `overrides` applied,
+  // which is much cheaper than setting every property when creating many
+  // clients with the same configs
+  KafkaClient(rd_kafka_type_t type, const KafkaConfTemplate &conf_template,
+              const KafkaConfTemplate::Properties &overrides,
+              const LogConfigs &log_configs, bool with_queue = false,
+              RebalanceCallback rebalance_callback = {},
+              DeliveryReportCallback delivery_report_callback = {},
+              StatsCallback stats_callback = {})
       : opaque_(std::make_unique<Opaque>()), rk_(nullptr, &rd_kafka_destroy),
         queue_(nullptr, &rd_kafka_queue_destroy) {
     std::array<char, 512> errstr;
@@ -52,37 +94,27 @@ public:
       throw std::runtime_error(message);
     };
 
-    auto *rk_conf = rd_kafka_conf_new();
-    for (auto &&[key, value] : configs) {
-      if (rd_kafka_conf_set(rk_conf, key.c_str(), value.c_str(), errstr.data(),
-                            errstr.size()) != RD_KAFKA_CONF_OK) {
-        rd_kafka_conf_destroy(rk_conf);
-        std::string message = "Failed to set ";
-        message += key;
-        message += " => ";
-        message += value;
-        message += ": ";
-        message += errstr.data();
-        throw std::runtime_error(message);
-      }
-    }
+    auto *rk_conf = conf_template.dup(overrides);
 
     opaque_->rebalance_callback = std::move(rebalance_callback);
     opaque_->delivery_report_callback = std::move(delivery_report_callback);
+    opaque_->stats_callback = std::move(stats_callback);
     rd_kafka_conf_set_opaque(rk_conf, opaque_.get());
 
     if (log_configs.enabled) {
-      std::ostream *log_output = &std::cout;
+      // The console is resolved for each line, which goes to the standard
+      // error while the standard output carries data
+      std::ostream *log_output = nullptr;
       if (!log_configs.path.empty()) {
-        log_file_ =
+        log_file_.file =
             std::make_unique<std::ofstream>(log_configs.path, std::ios::app);
-        if (!log_file_->is_open()) {
+        if (!log_file_.file->is_open()) {
           rd_kafka_conf_destroy(rk_conf);
           std::string message = "Failed to open log file: ";
           message += log_configs.path;
           throw std::runtime_error(message);
         }
-        log_output = log_file_.get();
+        log_output = log_file_.file.get();
       }
       opaque_->log_output = log_output;
       rd_kafka_conf_set_log_cb(rk_conf, &KafkaClient::log_callback);
@@ -97,6 +129,9 @@ public:
       rd_kafka_conf_set_dr_msg_cb(rk_conf,
                                   &KafkaClient::delivery_report_callback);
     }
+    if (opaque_->stats_callback) {
+      rd_kafka_conf_set_stats_cb(rk_conf, &KafkaClient::stats_callback);
+    }
 
     auto *rk = rd_kafka_new(type, rk_conf, errstr.data(), errstr.size());
     if (rk == nullptr) {
@@ -104,6 +139,11 @@ public:
       fail(type == RD_KAFKA_PRODUCER ? "create producer" : "create consumer");
     }
     rk_.reset(rk);
+    if (type == RD_KAFKA_CONSUMER && opaque_->stats_callback) {
+      // Statistics are served from the main queue, which a consumer only
+      // polls once it's forwarded to the consumer queue
+      rd_kafka_poll_set_consumer(rk);
+    }
 
     if (with_queue) {
       auto *rkqu = rd_kafka_queue_new(rk_.get());
@@ -114,15 +154,69 @@ public:
     }
   }
 
+  KafkaClient(const KafkaClient &) = delete;
+  KafkaClient &operator=(const KafkaClient &) = delete;
+
+  ~KafkaClient() {
+    main_queue_events_.reset();
+    queue_.reset();
+    rk_.reset();
+  }
+
   auto rk() const noexcept { return rk_.get(); }
 
+  // The client must be created with a rebalance callback, which runs the
+  // callback, and this must be called before subscribing
+  void set_assign_callback(AssignCallback callback) {
+    opaque_->assign_callback = std::move(callback);
+  }
+
   auto queue() const noexcept { return queue_.get(); }
 
+  // Make the returned file descriptor readable when the main queue, which
+  // serves the delivery reports and statistics, has something to serve, so
+  // that the caller can wait for it instead of polling periodically
+  int enable_main_queue_events() {
+    if (!main_queue_events_) {
+      main_queue_events_ =
+          std::make_unique<QueueEventFd>(rd_kafka_queue_get_main(rk_.get()));
+    }
+    return main_queue_events_->fd();
+  }
+
+  // Serve the main queue
+  void poll(int timeout_ms) {
+    if (main_queue_events_) {
+      main_queue_events_->drain();
+    }
+    rd_kafka_poll(rk_.get(), timeout_ms);
+  }
+
 private:
+  // The log file, which must outlive `rk_`. The lines buffered by the logger
+  // keep pointing to it, so they are written before it's closed, including
+  // when the constructor throws.
+  struct LogFile {
+    std::unique_ptr<std::ofstream> file;
+
+    ~LogFile() {
+      if (file) {
+        logging::flush();
+      }
+    }
+  };
+
   struct Opaque {
-    std::ostream *log_output = &std::cout;
+    // nullptr means logging::console()
+    std::ostream *log_output = nullptr;
     RebalanceCallback rebalance_callback;
+    AssignCallback assign_callback;
     DeliveryReportCallback delivery_report_callback;
+    StatsCallback stats_callback;
+    // Only accessed by the rebalance callback
+    std::optional<std::chrono::steady_clock::time_point> revoked_at;
+    std::optional<std::chrono::steady_clock::time_point> unassigned_since;
+    int partitions = 0;
   };
 
   static Opaque *opaque(const rd_kafka_t *rk) noexcept {
@@ -134,10 +228,14 @@ private:
     auto *context = opaque(rk);
     auto *output = context != nullptr && context->log_output != nullptr
                        ? context->log_output
-                       : &std::cout;
-    std::ostringstream oss;
-    oss << '[' << level << "] " << fac << ": " << buf;
-    logging::write_line(*output, oss.str());
+                       : &logging::console();
+    std::string line = "[";
+    line += std::to_string(level);
+    line += "] ";
+    line += fac;
+    line += ": ";
+    line += buf;
+    logging::write_line(*output, line);
   }
 
   static void noop_log_callback(const rd_kafka_t *rk, int level,
@@ -152,14 +250,76 @@ private:
     }
   }
 
+  static int stats_callback(rd_kafka_t *, char *json, size_t json_len,
+                            void *opaque_ptr) {
+    auto *context = static_cast<Opaque *>(opaque_ptr);
+    if (context != nullptr && context->stats_callback) {
+      context->stats_callback(json, json_len);
+    }
+    // librdkafka frees the JSON
+    return 0;
+  }
+
   static void rebalance_callback(rd_kafka_t *rk, rd_kafka_resp_err_t err,
                                  rd_kafka_topic_partition_list_t *partitions,
                                  void *opaque_ptr) {
-    sync_rebalance_state(rk, err, partitions);
     auto *context = static_cast<Opaque *>(opaque_ptr);
-    if (context != nullptr && context->rebalance_callback) {
-      context->rebalance_callback(rk, err, partitions);
+    if (err == RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS && partitions != nullptr &&
+        context != nullptr && context->assign_callback) {
+      context->assign_callback(partitions);
+    }
+    RebalanceEvent event;
+    event.cooperative = use_cooperative_rebalancing(rk);
+    const auto start = std::chrono::steady_clock::now();
+    sync_rebalance_state(rk, err, partitions);
+    const auto end = std::chrono::steady_clock::now();
+    event.sync_time =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    if (context == nullptr) {
+      return;
+    }
+    track_rebalance(*context, rk, err, start, end, event);
+    if (context->rebalance_callback) {
+      context->rebalance_callback(rk, err, partitions, event);
+    }
+  }
+
+  static void track_rebalance(Opaque &context, rd_kafka_t *rk,
+                              rd_kafka_resp_err_t err,
+                              std::chrono::steady_clock::time_point start,
+                              std::chrono::steady_clock::time_point end,
+                              RebalanceEvent &event) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    if (err != RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS) {
+      if (!context.revoked_at.has_value()) {
+        context.revoked_at = start;
+      }
+    } else if (context.revoked_at.has_value()) {
+      event.since_revoke =
+          duration_cast<microseconds>(end - *context.revoked_at);
+      context.revoked_at.reset();
+    }
+
+    event.partitions = assignment_size(rk);
+    if (event.partitions == 0 && context.partitions > 0) {
+      context.unassigned_since = end;
+    } else if (event.partitions > 0 && context.unassigned_since.has_value()) {
+      event.unassigned_time =
+          duration_cast<microseconds>(end - *context.unassigned_since);
+      context.unassigned_since.reset();
+    }
+    context.partitions = event.partitions;
+  }
+
+  static int assignment_size(rd_kafka_t *rk) noexcept {
+    rd_kafka_topic_partition_list_t *assignment = nullptr;
+    if (rd_kafka_assignment(rk, &assignment) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+      return 0;
     }
+    const auto size = assignment->cnt;
+    rd_kafka_topic_partition_list_destroy(assignment);
+    return size;
   }
 
   static bool use_cooperative_rebalancing(rd_kafka_t *rk) noexcept {
@@ -217,7 +377,8 @@ private:
   }
 
   std::unique_ptr<Opaque> opaque_;
-  std::unique_ptr<std::ofstream> log_file_;
+  LogFile log_file_;
   std::unique_ptr<rd_kafka_t, decltype(&rd_kafka_destroy)> rk_;
   std::unique_ptr<rd_kafka_queue_t, decltype(&rd_kafka_queue_destroy)> queue_;
+  std::unique_ptr<QueueEventFd> main_queue_events_;
 };
@@ -0,0 +1,68 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <array>
+#include <librdkafka/rdkafka.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+// A librdkafka configuration whose properties are set and validated once.
+// Each client gets a copy from dup() with only its own properties, e.g.
+// client.id, set on top, so creating many clients doesn't repeat the work for
+// every property.
+class KafkaConfTemplate final {
+public:
+  using Properties = std::unordered_map<std::string, std::string>;
+
+  explicit KafkaConfTemplate(const Properties &configs)
+      : conf_(rd_kafka_conf_new(), &rd_kafka_conf_destroy) {
+    set_all(conf_.get(), configs);
+  }
+
+  // Return a copy with `overrides` applied, which is owned by the caller
+  rd_kafka_conf_t *dup(const Properties &overrides = {}) const {
+    auto *rk_conf = rd_kafka_conf_dup(conf_.get());
+    try {
+      set_all(rk_conf, overrides);
+    } catch (...) {
+      rd_kafka_conf_destroy(rk_conf);
+      throw;
+    }
+    return rk_conf;
+  }
+
+private:
+  std::unique_ptr<rd_kafka_conf_t, decltype(&rd_kafka_conf_destroy)> conf_;
+
+  static void set_all(rd_kafka_conf_t *rk_conf, const Properties &configs) {
+    std::array<char, 512> errstr;
+    for (auto &&[key, value] : configs) {
+      if (rd_kafka_conf_set(rk_conf, key.c_str(), value.c_str(), errstr.data(),
+                            errstr.size()) != RD_KAFKA_CONF_OK) {
+        std::string message = "Failed to set ";
+        message += key;
+        message += " => ";
+        message += value;
+        message += ": ";
+        message += errstr.data();
+        throw std::runtime_error(message);
+      }
+    }
+  }
+};
@@ -0,0 +1,185 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// An HDR-style histogram of microsecond values. Values below 128 us are exact,
+// larger values fall into log-linear buckets with a relative error below 1/64.
+class LatencyHistogram final {
+public:
+  static constexpr int sub_bucket_bits = 7;
+  static constexpr uint64_t sub_bucket_count = uint64_t{1} << sub_bucket_bits;
+  static constexpr uint64_t sub_bucket_half = sub_bucket_count / 2;
+  // Values are clamped to 2^40 us, i.e. about 12 days
+  static constexpr int max_value_bits = 40;
+  static constexpr size_t bucket_count =
+      (max_value_bits - sub_bucket_bits + 2) * sub_bucket_half;
+
+  static size_t index_of(uint64_t value) noexcept {
+    value = std::min(value, (uint64_t{1} << max_value_bits) - 1);
+    if (value < sub_bucket_count) {
+      return static_cast<size_t>(value);
+    }
+    const auto msb = 63 - count_leading_zeros(value);
+    const auto shift = msb - (sub_bucket_bits - 1);
+    return static_cast<size_t>((shift + 1) * sub_bucket_half +
+                               ((value >> shift) - sub_bucket_half));
+  }
+
+  // The highest value that falls into the bucket
+  static uint64_t value_of(size_t index) noexcept {
+    if (index < sub_bucket_count) {
+      return index;
+    }
+    const auto shift = index / sub_bucket_half - 1;
+    const auto sub_bucket = index % sub_bucket_half + sub_bucket_half;
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+
+  void record(uint64_t value, uint64_t count = 1) noexcept {
+    counts_[index_of(value)] += count;
+    total_count_ += count;
+  }
+
+  void add(size_t index, uint64_t count) noexcept {
+    counts_[index] += count;
+    total_count_ += count;
+  }
+
+  void merge(const LatencyHistogram &other) noexcept {
+    for (size_t i = 0; i < bucket_count; i++) {
+      counts_[i] += other.counts_[i];
+    }
+    total_count_ += other.total_count_;
+  }
+
+  // Return the histogram of the values recorded since `previous`, which must
+  // be an earlier snapshot of the same histogram
+  LatencyHistogram since(const LatencyHistogram &previous) const noexcept {
+    LatencyHistogram delta;
+    for (size_t i = 0; i < bucket_count; i++) {
+      delta.counts_[i] = counts_[i] - previous.counts_[i];
+    }
+    delta.total_count_ = total_count_ - previous.total_count_;
+    return delta;
+  }
+
+  uint64_t count() const noexcept { return total_count_; }
+
+  // `percentile` is in [0, 100]
+  uint64_t value_at_percentile(double percentile) const noexcept {
+    if (total_count_ == 0) {
+      return 0;
+    }
+    auto target = static_cast<uint64_t>(
+        percentile / 100.0 * static_cast<double>(total_count_) + 0.5);
+    target = std::clamp<uint64_t>(target, 1, total_count_);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; i++) {
+      seen += counts_[i];
+      if (seen >= target) {
+        return value_of(i);
+      }
+    }
+    return max();
+  }
+
+  uint64_t max() const noexcept {
+    for (size_t i = bucket_count; i > 0; i--) {
+      if (counts_[i - 1] > 0) {
+        return value_of(i - 1);
+      }
+    }
+    return 0;
+  }
+
+  // Format as "p50: <ms> ms, p90: ..., p99: ..., p99.9: ..., max: ..."
+  std::string format_percentiles() const {
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(3);
+    oss << "p50: " << to_ms(value_at_percentile(50))
+        << " ms, p90: " << to_ms(value_at_percentile(90))
+        << " ms, p99: " << to_ms(value_at_percentile(99))
+        << " ms, p99.9: " << to_ms(value_at_percentile(99.9))
+        << " ms, max: " << to_ms(max()) << " ms";
+    return oss.str();
+  }
+
+private:
+  std::array<uint64_t, bucket_count> counts_{};
+  uint64_t total_count_ = 0;
+
+  static int count_leading_zeros(uint64_t value) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(value);
+#else
+    int zeros = 0;
+    for (auto mask = uint64_t{1} << 63; (value & mask) == 0; mask >>= 1) {
+      zeros++;
+    }
+    return zeros;
+#endif
+  }
+
+  static double to_ms(uint64_t value_us) noexcept {
+    return static_cast<double>(value_us) / 1000.0;
+  }
+};
+
+// A LatencyHistogram that is written by a single thread and can be read by
+// others. Recording is a relaxed load and store, so no cache line is shared
+// between writers as long as each thread owns its own recorder.
+class LatencyRecorder final {
+public:
+  void record(uint64_t value) noexcept {
+    auto &count = counts_[LatencyHistogram::index_of(value)];
+    count.store(count.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+  }
+
+  // Add the recorded values into `histogram`
+  void snapshot_into(LatencyHistogram &histogram) const noexcept {
+    for (size_t i = 0; i < LatencyHistogram::bucket_count; i++) {
+      if (const auto count = counts_[i].load(std::memory_order_relaxed);
+          count > 0) {
+        histogram.add(i, count);
+      }
+    }
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, LatencyHistogram::bucket_count> counts_{};
+};
+
+// Merge the snapshots of the recorders of all threads
+inline LatencyHistogram merge_snapshots(
+    const std::vector<std::unique_ptr<LatencyRecorder>> &recorders) {
+  LatencyHistogram histogram;
+  for (auto &&recorder : recorders) {
+    recorder->snapshot_into(histogram);
+  }
+  return histogram;
+}
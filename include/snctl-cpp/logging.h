@@ -15,15 +15,25 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <ostream>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace logging {
 
@@ -52,52 +62,344 @@ format_timestamp(std::chrono::system_clock::time_point time_point) {
   return oss.str();
 }
 
+// Format timestamps like format_timestamp(), but convert to the local time only
+// once per second. Not thread-safe.
+class TimestampFormatter final {
+public:
+  void append(std::string &output,
+              std::chrono::system_clock::time_point time_point) {
+    const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            time_point.time_since_epoch())
+                            .count();
+    auto seconds = millis / 1000;
+    auto remainder = millis % 1000;
+    if (remainder < 0) {
+      seconds--;
+      remainder += 1000;
+    }
+    if (prefix_.empty() || seconds != seconds_) {
+      prefix_ = format_timestamp(std::chrono::system_clock::time_point(
+          std::chrono::seconds(seconds)));
+      // Strip the milliseconds
+      prefix_.resize(prefix_.size() - 4);
+      seconds_ = seconds;
+    }
+    output += prefix_;
+    output += '.';
+    output += static_cast<char>('0' + remainder / 100);
+    output += static_cast<char>('0' + remainder / 10 % 10);
+    output += static_cast<char>('0' + remainder % 10);
+  }
+
+private:
+  std::string prefix_;
+  int64_t seconds_ = 0;
+};
+
 inline std::string timestamp_now() {
   return format_timestamp(std::chrono::system_clock::now());
 }
 
+// The backend of write_line(). Each thread appends whole lines to its own
+// buffer, and a background thread writes the buffered lines of all threads in
+// the order they were appended, at least every 10 ms. A thread whose buffer
+// reaches 256 KiB flushes all buffers by itself, which bounds both the memory
+// and the time a line stays buffered. Each write holds mutex(), so lines are
+// never interleaved with other output that holds it.
+class AsyncWriter final {
+public:
+  static AsyncWriter &instance() {
+    static AsyncWriter writer;
+    return writer;
+  }
+
+  // Set once the instance is destroyed, after which lines are written directly
+  static std::atomic<bool> &destroyed() {
+    static std::atomic<bool> instance{false};
+    return instance;
+  }
+
+  AsyncWriter(const AsyncWriter &) = delete;
+  AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+  ~AsyncWriter() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+    destroyed() = true;
+  }
+
+  void write(std::ostream &output, std::string_view message) {
+    auto &buffer = local_buffer();
+    {
+      std::shared_lock<std::shared_mutex> sequence_lock(sequence_mu_);
+      std::lock_guard<std::mutex> lock(buffer.mu);
+      auto &text = buffer.text;
+      const auto offset = text.size();
+      buffer.formatter.append(text, std::chrono::system_clock::now());
+      text += ' ';
+      text += message;
+      text += '\n';
+      buffer.entries.emplace_back(Entry{
+          next_sequence_.fetch_add(1, std::memory_order_relaxed), &output,
+          offset, text.size() - offset});
+      if (text.size() < max_buffer_bytes) {
+        return;
+      }
+    }
+    // Wait for a flush rather than writing this buffer alone, which could
+    // overtake the earlier lines that are being written
+    flush();
+  }
+
+  // Write the lines buffered by all threads
+  void flush() {
+    std::lock_guard<std::mutex> flush_lock(flush_mu_);
+    std::vector<Drained> drained;
+    std::vector<Buffer *> exited;
+    {
+      // Drain all buffers at once, so that a line appended after this flush
+      // can't be written before an earlier line of another buffer
+      std::unique_lock<std::shared_mutex> sequence_lock(sequence_mu_);
+      std::vector<std::shared_ptr<Buffer>> buffers;
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        buffers = buffers_;
+      }
+      drained.resize(buffers.size());
+      for (size_t i = 0; i < buffers.size(); i++) {
+        // Nothing is appended after the flag is set, so the buffer can be
+        // dropped once it's drained
+        if (buffers[i]->exited.load()) {
+          exited.emplace_back(buffers[i].get());
+        }
+        std::lock_guard<std::mutex> lock(buffers[i]->mu);
+        drain(*buffers[i], drained[i]);
+      }
+    }
+    write_in_order(drained);
+    if (!exited.empty()) {
+      std::lock_guard<std::mutex> lock(mu_);
+      buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+                                    [&exited](const auto &buffer) {
+                                      return std::find(exited.begin(),
+                                                       exited.end(),
+                                                       buffer.get()) !=
+                                             exited.end();
+                                    }),
+                     buffers_.end());
+    }
+  }
+
+private:
+  static constexpr size_t max_buffer_bytes = 256 * 1024;
+  static constexpr auto flush_interval = std::chrono::milliseconds(10);
+
+  struct Entry {
+    uint64_t sequence;
+    std::ostream *output;
+    // The line's position in the buffer's text
+    size_t offset;
+    size_t size;
+  };
+
+  struct Buffer {
+    std::mutex mu;
+    std::string text;
+    std::vector<Entry> entries;
+    TimestampFormatter formatter;
+    std::atomic<bool> exited{false};
+  };
+
+  struct Drained {
+    std::string text;
+    std::vector<Entry> entries;
+  };
+
+  // Marks the buffer when its thread exits
+  struct BufferHolder {
+    std::shared_ptr<Buffer> buffer;
+
+    ~BufferHolder() { buffer->exited = true; }
+  };
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::vector<std::shared_ptr<Buffer>> buffers_;
+  // Serializes the flushes of the background thread and explicit flush()
+  // calls
+  std::mutex flush_mu_;
+  // Shared by the writers while they take a sequence and append a line, and
+  // exclusively held by a flush while it drains the buffers
+  std::shared_mutex sequence_mu_;
+  std::atomic<uint64_t> next_sequence_{0};
+  std::thread thread_;
+
+  AsyncWriter() {
+    // Construct the mutex first, so that it outlives the background thread
+    mutex();
+    thread_ = std::thread([this] { run(); });
+  }
+
+  Buffer &local_buffer() {
+    thread_local BufferHolder holder{register_buffer()};
+    return *holder.buffer;
+  }
+
+  std::shared_ptr<Buffer> register_buffer() {
+    auto buffer = std::make_shared<Buffer>();
+    std::lock_guard<std::mutex> lock(mu_);
+    buffers_.emplace_back(buffer);
+    return buffer;
+  }
+
+  void run() {
+    while (true) {
+      bool stopping;
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait_for(lock, flush_interval, [this] { return stopping_; });
+        stopping = stopping_;
+      }
+      flush();
+      if (stopping) {
+        return;
+      }
+    }
+  }
+
+  static void drain(Buffer &buffer, Drained &drained) {
+    drained.text.swap(buffer.text);
+    drained.entries.swap(buffer.entries);
+  }
+
+  // Write the drained lines in the order of their sequences, grouping
+  // consecutive lines of the same output into one write
+  static void write_in_order(const std::vector<Drained> &drained) {
+    std::vector<std::pair<const Drained *, const Entry *>> lines;
+    for (auto &&buffer : drained) {
+      for (auto &&entry : buffer.entries) {
+        lines.emplace_back(&buffer, &entry);
+      }
+    }
+    if (lines.empty()) {
+      return;
+    }
+    std::sort(lines.begin(), lines.end(), [](const auto &lhs, const auto &rhs) {
+      return lhs.second->sequence < rhs.second->sequence;
+    });
+
+    std::lock_guard<std::mutex> lock(mutex());
+    std::string chunk;
+    std::ostream *output = lines[0].second->output;
+    for (auto &&[buffer, entry] : lines) {
+      if (entry->output != output) {
+        output->write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        output->flush();
+        chunk.clear();
+        output = entry->output;
+      }
+      chunk.append(buffer->text, entry->offset, entry->size);
+    }
+    output->write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    output->flush();
+  }
+};
+
 inline void write_line(std::ostream &output, std::string_view message) {
-  std::lock_guard<std::mutex> lock(mutex());
-  output << timestamp_now() << ' ' << message << '\n';
-  output.flush();
+  if (AsyncWriter::destroyed().load()) {
+    std::lock_guard<std::mutex> lock(mutex());
+    output << timestamp_now() << ' ' << message << '\n';
+    output.flush();
+    return;
+  }
+  AsyncWriter::instance().write(output, message);
+}
+
+// Write the lines that are still buffered, e.g. before writing to the output
+// without write_line()
+inline void flush() {
+  if (!AsyncWriter::destroyed().load()) {
+    AsyncWriter::instance().flush();
+  }
 }
 
 class Line final {
 public:
-  explicit Line(std::ostream &output) : output_(output) {}
+  explicit Line(std::ostream &output)
+      : output_(output), buffer_(acquire_stream()) {}
 
   Line(const Line &) = delete;
   Line &operator=(const Line &) = delete;
 
   Line(Line &&other) noexcept
-      : output_(other.output_), buffer_(std::move(other.buffer_)),
-        flushed_(other.flushed_) {
-    other.flushed_ = true;
-  }
+      : output_(other.output_), buffer_(std::move(other.buffer_)) {}
 
   ~Line() { flush(); }
 
   template <typename T> Line &operator<<(const T &value) {
-    buffer_ << value;
+    *buffer_ << value;
     return *this;
   }
 
 private:
   void flush() {
-    if (flushed_) {
+    if (!buffer_) {
       return;
     }
-    write_line(output_, buffer_.str());
-    flushed_ = true;
+    write_line(output_, buffer_->str());
+    release_stream(std::move(buffer_));
+  }
+
+  // The streams of finished lines are reused by the next lines of the same
+  // thread. A thread may build several lines at a time.
+  static std::vector<std::unique_ptr<std::ostringstream>> &free_streams() {
+    thread_local std::vector<std::unique_ptr<std::ostringstream>> streams;
+    return streams;
+  }
+
+  static std::unique_ptr<std::ostringstream> acquire_stream() {
+    auto &streams = free_streams();
+    if (streams.empty()) {
+      return std::make_unique<std::ostringstream>();
+    }
+    auto stream = std::move(streams.back());
+    streams.pop_back();
+    return stream;
+  }
+
+  static void release_stream(std::unique_ptr<std::ostringstream> stream) {
+    stream->str(std::string());
+    stream->clear();
+    stream->flags(std::ios_base::skipws | std::ios_base::dec);
+    stream->precision(6);
+    stream->width(0);
+    stream->fill(' ');
+    free_streams().emplace_back(std::move(stream));
   }
 
   std::ostream &output_;
-  std::ostringstream buffer_;
-  bool flushed_ = false;
+  std::unique_ptr<std::ostringstream> buffer_;
 };
 
-inline Line out() { return Line(std::cout); }
+// Set when the standard output carries data, e.g. `consume --output -`, so that
+// all lines go to the standard error instead
+inline std::atomic<bool> &stdout_reserved() {
+  static std::atomic<bool> instance{false};
+  return instance;
+}
+
+inline std::ostream &console() {
+  return stdout_reserved().load(std::memory_order_relaxed) ? std::cerr
+                                                           : std::cout;
+}
+
+inline Line out() { return Line(console()); }
 
-inline Line err() { return Line(std::cout); }
+inline Line err() { return Line(console()); }
 
 } // namespace logging
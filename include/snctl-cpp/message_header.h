@@ -0,0 +1,118 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+// The "producer=<index> sequence=<sequence>[ timestamp=<us>]" header written by
+// `produce` at the beginning of each key and payload. Both formatting and
+// parsing never allocate.
+class MessageHeader final {
+public:
+  static constexpr size_t max_size = 96;
+
+  using Buffer = std::array<char, max_size>;
+
+  int producer_index = 0;
+  uint64_t sequence = 0;
+  // Microseconds since the epoch of the system clock when the message was
+  // produced, 0 if the header does not carry a timestamp
+  int64_t timestamp_us = 0;
+
+  static int64_t now_us() noexcept {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Format the header into `buffer` and return the number of bytes written.
+  // The timestamp is omitted if `timestamp_us` is 0.
+  static size_t format(Buffer &buffer, int producer_index, uint64_t sequence,
+                       int64_t timestamp_us = 0) noexcept {
+    auto *it = buffer.data();
+    auto *end = buffer.data() + buffer.size();
+    it = append(it, "producer=");
+    it = std::to_chars(it, end, producer_index).ptr;
+    it = append(it, " sequence=");
+    it = std::to_chars(it, end, sequence).ptr;
+    if (timestamp_us != 0) {
+      it = append(it, " timestamp=");
+      it = std::to_chars(it, end, timestamp_us).ptr;
+    }
+    return static_cast<size_t>(it - buffer.data());
+  }
+
+  // Parse the header at the beginning of `data`, return std::nullopt if it's
+  // not written by `produce` or it's truncated. A number must be followed by
+  // another byte, since one that runs to the end of `data` may be cut off.
+  static std::optional<MessageHeader> parse(const void *data,
+                                            size_t size) noexcept {
+    if (data == nullptr) {
+      return std::nullopt;
+    }
+    const auto *it = static_cast<const char *>(data);
+    const auto *end = it + size;
+
+    MessageHeader header;
+    if (!consume(it, end, "producer=") ||
+        !parse_number(it, end, header.producer_index) ||
+        !consume(it, end, " sequence=") ||
+        !parse_number(it, end, header.sequence)) {
+      return std::nullopt;
+    }
+    if (consume(it, end, " timestamp=") &&
+        !parse_number(it, end, header.timestamp_us)) {
+      return std::nullopt;
+    }
+    return header;
+  }
+
+private:
+  template <size_t N>
+  static char *append(char *it, const char (&literal)[N]) noexcept {
+    std::memcpy(it, literal, N - 1);
+    return it + N - 1;
+  }
+
+  template <size_t N>
+  static bool consume(const char *&it, const char *end,
+                      const char (&literal)[N]) noexcept {
+    if (static_cast<size_t>(end - it) < N - 1 ||
+        std::memcmp(it, literal, N - 1) != 0) {
+      return false;
+    }
+    it += N - 1;
+    return true;
+  }
+
+  template <typename T>
+  static bool parse_number(const char *&it, const char *end,
+                           T &value) noexcept {
+    const auto result = std::from_chars(it, end, value);
+    if (result.ec != std::errc{} || result.ptr == end) {
+      return false;
+    }
+    it = result.ptr;
+    return true;
+  }
+};
@@ -0,0 +1,362 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/latency_histogram.h"
+#include "snctl-cpp/logging.h"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// Write the interval samples of a command to a file, for dashboards and for
+// comparing runs:
+// - json: a JSON object per sample and line
+// - csv: a header line with the field names, then a line per sample
+// - prometheus: a textfile-collector file with the latest sample, which is
+//   written to "<path>.tmp" and renamed, so a scrape never sees a partial file
+//
+// The reporter thread only queues the samples, which a background thread
+// formats and writes.
+class MetricsEmitter final {
+public:
+  enum class Format { JsonLines, Csv, Prometheus };
+
+  enum class Kind { Gauge, Counter };
+
+  static Format parse_format(const std::string &name) {
+    if (name == "json") {
+      return Format::JsonLines;
+    } else if (name == "csv") {
+      return Format::Csv;
+    } else if (name == "prometheus") {
+      return Format::Prometheus;
+    }
+    throw std::invalid_argument("Unknown metrics format: " + name);
+  }
+
+  // The fields of a sample. Every sample of a run must add the same fields in
+  // the same order, so that they line up with the CSV header.
+  class Sample final {
+  public:
+    Sample() : time_(std::chrono::system_clock::now()) {}
+
+    // A field without a value is null in JSON, empty in CSV and omitted in the
+    // Prometheus file
+    void add(std::string name, std::optional<double> value,
+             Kind kind = Kind::Gauge) {
+      fields_.emplace_back(Field{std::move(name), value, kind});
+    }
+
+    // A total since the start, e.g. "consumed_messages_total"
+    void add_total(std::string name, uint64_t value) {
+      add(std::move(name), static_cast<double>(value), Kind::Counter);
+    }
+
+    // Add "<name>_p50_ms", "<name>_p90_ms", "<name>_p99_ms",
+    // "<name>_p999_ms" and "<name>_max_ms", which have no value if nothing
+    // was recorded
+    void add_latency(const std::string &name,
+                     const LatencyHistogram &histogram) {
+      static const std::pair<const char *, double> percentiles[] = {
+          {"_p50_ms", 50},
+          {"_p90_ms", 90},
+          {"_p99_ms", 99},
+          {"_p999_ms", 99.9}};
+      const auto has_values = histogram.count() > 0;
+      for (auto &&[suffix, percentile] : percentiles) {
+        add_optional(name + suffix, has_values, [&histogram, percentile] {
+          return histogram.value_at_percentile(percentile);
+        });
+      }
+      add_optional(name + "_max_ms", has_values,
+                   [&histogram] { return histogram.max(); });
+    }
+
+  private:
+    friend class MetricsEmitter;
+
+    struct Field {
+      std::string name;
+      std::optional<double> value;
+      Kind kind;
+    };
+
+    std::chrono::system_clock::time_point time_;
+    std::vector<Field> fields_;
+
+    template <typename ValueUs>
+    void add_optional(std::string name, bool has_value, ValueUs &&value_us) {
+      Field field{std::move(name), std::nullopt, Kind::Gauge};
+      if (has_value) {
+        field.value = static_cast<double>(value_us()) / 1000.0;
+      }
+      fields_.emplace_back(std::move(field));
+    }
+  };
+
+  // `command` and `topic` label each sample
+  MetricsEmitter(std::string path, Format format, std::string command,
+                 std::string topic)
+      : path_(std::move(path)), format_(format), command_(std::move(command)),
+        topic_(std::move(topic)) {
+    if (format_ != Format::Prometheus) {
+      fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd_ < 0) {
+        throw std::runtime_error("Failed to open " + path_ + ": " +
+                                 std::strerror(errno));
+      }
+    }
+    writer_thread_ = std::thread([this] { run(); });
+  }
+
+  MetricsEmitter(const MetricsEmitter &) = delete;
+  MetricsEmitter &operator=(const MetricsEmitter &) = delete;
+
+  ~MetricsEmitter() {
+    try {
+      close();
+    } catch (const std::exception &) {
+    }
+  }
+
+  void emit(Sample sample) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (closed_) {
+        return;
+      }
+      pending_.emplace_back(std::move(sample));
+    }
+    cv_.notify_one();
+  }
+
+  // Write the queued samples and close the file. Throw if any write failed.
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (closed_) {
+        return;
+      }
+      closed_ = true;
+    }
+    cv_.notify_one();
+    if (writer_thread_.joinable()) {
+      writer_thread_.join();
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+    if (!error_.empty()) {
+      throw std::runtime_error(error_);
+    }
+  }
+
+  const std::string &path() const noexcept { return path_; }
+
+private:
+  const std::string path_;
+  const Format format_;
+  const std::string command_;
+  const std::string topic_;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<Sample> pending_;
+  bool closed_ = false;
+  // Only accessed by the writer thread until it's joined
+  std::string error_;
+  int fd_ = -1;
+  bool header_written_ = false;
+  std::thread writer_thread_;
+
+  void run() {
+    std::string output;
+    while (true) {
+      std::optional<Sample> sample;
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [this] { return !pending_.empty() || closed_; });
+        if (pending_.empty()) {
+          return;
+        }
+        sample.emplace(std::move(pending_.front()));
+        pending_.pop_front();
+      }
+      if (!error_.empty()) {
+        continue;
+      }
+      output.clear();
+      try {
+        switch (format_) {
+        case Format::JsonLines:
+          format_json(*sample, output);
+          write_all(fd_, path_, output);
+          break;
+        case Format::Csv:
+          format_csv(*sample, output);
+          write_all(fd_, path_, output);
+          break;
+        case Format::Prometheus:
+          format_prometheus(*sample, output);
+          replace_file(output);
+          break;
+        }
+      } catch (const std::exception &e) {
+        error_ = e.what();
+        logging::err() << "Stopped writing metrics: " << error_;
+      }
+    }
+  }
+
+  static int64_t to_epoch_ms(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               time.time_since_epoch())
+        .count();
+  }
+
+  static void append_number(std::string &output, double value) {
+    char buffer[32];
+    const auto size = std::snprintf(buffer, sizeof(buffer), "%.15g", value);
+    output.append(buffer, static_cast<size_t>(size));
+  }
+
+  // Escape a string for a JSON value or a Prometheus label value
+  static void append_quoted(std::string &output, const std::string &value) {
+    output += '"';
+    for (auto c : value) {
+      if (c == '"' || c == '\\') {
+        output += '\\';
+        output += c;
+      } else if (c == '\n') {
+        output += "\\n";
+      } else {
+        output += c;
+      }
+    }
+    output += '"';
+  }
+
+  void format_json(const Sample &sample, std::string &output) const {
+    output += "{\"timestamp_ms\":";
+    output += std::to_string(to_epoch_ms(sample.time_));
+    output += ",\"command\":";
+    append_quoted(output, command_);
+    output += ",\"topic\":";
+    append_quoted(output, topic_);
+    for (auto &&field : sample.fields_) {
+      output += ",\"";
+      output += field.name;
+      output += "\":";
+      if (field.value.has_value()) {
+        append_number(output, *field.value);
+      } else {
+        output += "null";
+      }
+    }
+    output += "}\n";
+  }
+
+  void format_csv(const Sample &sample, std::string &output) {
+    if (!header_written_) {
+      output += "timestamp_ms";
+      for (auto &&field : sample.fields_) {
+        output += ',';
+        output += field.name;
+      }
+      output += '\n';
+      header_written_ = true;
+    }
+    output += std::to_string(to_epoch_ms(sample.time_));
+    for (auto &&field : sample.fields_) {
+      output += ',';
+      if (field.value.has_value()) {
+        append_number(output, *field.value);
+      }
+    }
+    output += '\n';
+  }
+
+  void format_prometheus(const Sample &sample, std::string &output) const {
+    for (auto &&field : sample.fields_) {
+      if (!field.value.has_value()) {
+        continue;
+      }
+      const auto name = "snctl_" + command_ + "_" + field.name;
+      output += "# TYPE ";
+      output += name;
+      output += field.kind == Kind::Counter ? " counter\n" : " gauge\n";
+      output += name;
+      output += "{topic=";
+      append_quoted(output, topic_);
+      output += "} ";
+      append_number(output, *field.value);
+      output += '\n';
+    }
+  }
+
+  void replace_file(const std::string &content) const {
+    const auto tmp_path = path_ + ".tmp";
+    const auto fd =
+        ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open " + tmp_path + ": " +
+                               std::strerror(errno));
+    }
+    try {
+      write_all(fd, tmp_path, content);
+    } catch (const std::exception &) {
+      ::close(fd);
+      throw;
+    }
+    ::close(fd);
+    if (std::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+      throw std::runtime_error("Failed to rename " + tmp_path + " to " +
+                               path_ + ": " + std::strerror(errno));
+    }
+  }
+
+  static void write_all(int fd, const std::string &path,
+                        const std::string &content) {
+    size_t offset = 0;
+    while (offset < content.size()) {
+      const auto n =
+          ::write(fd, content.data() + offset, content.size() - offset);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Failed to write " + path + ": " +
+                                 std::strerror(errno));
+      }
+      offset += static_cast<size_t>(n);
+    }
+  }
+};
@@ -0,0 +1,96 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+// A bounded lock-free queue with many producers and a single consumer. Each
+// slot carries a sequence number that tells whether it's free for the push at
+// that position or holds the value for the pop at that position, so a push is
+// one CAS on the tail and a pop needs no atomic read-modify-write at all.
+//
+// A push fails instead of waiting when the ring is full, so that producers,
+// e.g. the consumer threads, are never blocked by a slow reader.
+template <typename T> class MpscRing final {
+public:
+  // `capacity` must be a power of 2
+  explicit MpscRing(size_t capacity)
+      : mask_(capacity - 1), slots_(std::make_unique<Slot[]>(capacity)) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+      throw std::invalid_argument("The ring capacity must be a power of 2");
+    }
+    for (size_t i = 0; i < capacity; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscRing(const MpscRing &) = delete;
+  MpscRing &operator=(const MpscRing &) = delete;
+
+  // Return false if the ring is full
+  bool try_push(const T &value) noexcept {
+    auto position = tail_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[position & mask_];
+      const auto sequence = slot->sequence.load(std::memory_order_acquire);
+      const auto diff =
+          static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(position, position + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The reader has not popped the value pushed a lap ago
+        return false;
+      } else {
+        position = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = value;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Must be called by a single thread only. Return false if the ring is empty.
+  bool try_pop(T &value) noexcept {
+    auto &slot = slots_[head_ & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+    value = slot.value;
+    slot.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+    head_++;
+    return true;
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    T value;
+  };
+
+  const uint64_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(128) std::atomic<uint64_t> tail_{0};
+  // Only accessed by the reader
+  alignas(128) uint64_t head_ = 0;
+};
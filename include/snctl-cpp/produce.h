@@ -15,18 +15,32 @@
  */
 #pragma once
 
+#include "snctl-cpp/client_stats.h"
 #include "snctl-cpp/kafka_client.h"
+#include "snctl-cpp/kafka_conf_template.h"
+#include "snctl-cpp/latency_histogram.h"
 #include "snctl-cpp/logging.h"
+#include "snctl-cpp/message_header.h"
+#include "snctl-cpp/metrics_emitter.h"
+#include "snctl-cpp/produce/key_generator.h"
+#include "snctl-cpp/produce/pacer.h"
+#include "snctl-cpp/produce/payload_content.h"
+#include "snctl-cpp/produce/producer.h"
+#include "snctl-cpp/produce/rate_profile.h"
+#include "snctl-cpp/produce/saturation_search.h"
+#include "snctl-cpp/queue_events.h"
 #include "snctl-cpp/stop_signal.h"
+#include "snctl-cpp/topic_metadata.h"
 
 #include <argparse/argparse.hpp>
 #include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <ctime>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <thread>
@@ -40,21 +54,137 @@ public:
                              "total rate");
     command_.add_argument("topic").help("Topic to produce to").required();
     command_.add_argument("-n", "--producers")
-        .help("Number of producers")
+        .help("Number of producers, each of which is a client instance")
         .scan<'i', int>()
         .default_value(1);
+    command_.add_argument("--threads")
+        .help("Number of threads that drive the producers round-robin, 0 "
+              "means one thread per producer")
+        .scan<'i', int>()
+        .default_value(0);
     command_.add_argument("--rate")
-        .help("Total message rate in messages per second across all producers")
+        .help("Total message rate in messages per second across all "
+              "producers, which is the starting rate of a rate profile")
+        .scan<'i', int>();
+    command_.add_argument("--rate-profile")
+        .help("How the total rate changes over time: constant, ramp, step, "
+              "sine, csv or search (search for the highest rate that meets "
+              "--latency-target-ms)")
+        .default_value(std::string("constant"));
+    command_.add_argument("--rate-target")
+        .help("The final rate of a ramp or step profile, the peak rate of a "
+              "sine profile, or the maximum rate of a search")
+        .scan<'i', int>();
+    command_.add_argument("--rate-period-s")
+        .help("The duration of a ramp or step profile, or the period of a "
+              "sine profile, in seconds")
+        .scan<'i', int>()
+        .default_value(60);
+    command_.add_argument("--rate-steps")
+        .help("Number of steps of a step profile")
+        .scan<'i', int>()
+        .default_value(5);
+    command_.add_argument("--rate-file")
+        .help("CSV file of \"<seconds>,<rate>\" lines for the csv profile");
+    command_.add_argument("--latency-target-ms")
+        .help("The p99 delivery latency that a searched rate must meet")
+        .scan<'i', int>()
+        .default_value(100);
+    command_.add_argument("--search-step")
+        .help("How much a search increases the rate after each report "
+              "interval that met the target, 0 means 10% of --rate")
         .scan<'i', int>()
-        .required();
+        .default_value(0);
+    command_.add_argument("--search-backoff")
+        .help("The factor that a search multiplies the rate by after each "
+              "report interval that missed the target")
+        .scan<'g', double>()
+        .default_value(0.75);
+    command_.add_argument("--burst")
+        .help("Maximum number of messages each producer sends back-to-back "
+              "when it falls behind schedule, 0 means 10 ms worth of messages")
+        .scan<'i', int>()
+        .default_value(0);
+    command_.add_argument("--spin-us")
+        .help("Busy-spin instead of sleeping for the last microseconds before "
+              "a scheduled send")
+        .scan<'i', int>()
+        .default_value(50);
+    command_.add_argument("--event-poll")
+        .default_value(false)
+        .implicit_value(true)
+        .help("Wake up a producer thread as soon as delivery reports arrive "
+              "instead of polling its producers every 10 ms (eventfd and epoll "
+              "on Linux, a pipe and poll elsewhere)");
     command_.add_argument("--message-size")
         .help("Message payload size in bytes")
         .scan<'i', int>()
         .default_value(1024);
+    command_.add_argument("--payload")
+        .help("Payload content: filler (the letter 'x'), random (random "
+              "bytes), text (text that compresses by --compressibility) or "
+              "file (slices of --payload-file)")
+        .default_value(std::string("filler"));
+    command_.add_argument("--compressibility")
+        .help("Approximate compression ratio of the text payload")
+        .scan<'g', double>()
+        .default_value(2.0);
+    command_.add_argument("--payload-file")
+        .help("File that is memory-mapped and sliced into payloads, e.g. a "
+              "dump of real records");
+    command_.add_argument("--compression")
+        .help("The compression.codec of the producers, e.g. lz4 or zstd");
+    command_.add_argument("--key-distribution")
+        .help("How message keys are chosen: unique (a unique key per "
+              "message), none (no key), uniform, zipfian or sequential (over "
+              "--key-count keys or the keys of --key-file)")
+        .default_value(std::string("unique"));
+    command_.add_argument("--key-count")
+        .help("Number of distinct keys of the uniform, zipfian and sequential "
+              "distributions")
+        .scan<'i', int>()
+        .default_value(1000);
+    command_.add_argument("--zipf-theta")
+        .help("Skew of the zipfian key distribution, higher is more skewed")
+        .scan<'g', double>()
+        .default_value(0.99);
+    command_.add_argument("--key-file")
+        .help("File of keys, one per line, used instead of generated keys");
+    command_.add_argument("--payload-pool-size")
+        .help("Maximum number of payload buffers per producer, which also "
+              "bounds the in-flight messages of each producer")
+        .scan<'i', int>()
+        .default_value(16384);
+    command_.add_argument("--batch-size")
+        .help("Enqueue up to N messages per rd_kafka_produce_batch() call, 0 "
+              "means one rd_kafka_producev() call per message")
+        .scan<'i', int>()
+        .default_value(0);
+    command_.add_argument("--transactional")
+        .default_value(false)
+        .implicit_value(true)
+        .help("Wrap the messages of each producer into transactions, which "
+              "block the thread that drives the producer while committing");
+    command_.add_argument("--txn-size")
+        .help("Number of messages per transaction")
+        .scan<'i', int>()
+        .default_value(1000);
     command_.add_argument("--report-interval-ms")
         .help("Stats report interval in milliseconds")
         .scan<'i', int>()
         .default_value(1000);
+    command_.add_argument("--client-stats")
+        .default_value(false)
+        .implicit_value(true)
+        .help("Report librdkafka's statistics every interval, e.g. the broker "
+              "round-trip times, the internal queue latency and batch sizes");
+    command_.add_argument("--metrics-file")
+        .help("Also write the stats of every interval to a file in the "
+              "--metrics-format format");
+    command_.add_argument("--metrics-format")
+        .help("Format of --metrics-file: json (an object per line), csv or "
+              "prometheus (a textfile-collector file replaced every interval)")
+        .default_value(std::string("json"));
 
     parent.add_subparser(command_);
   }
@@ -68,113 +198,247 @@ public:
            const std::optional<std::string> &client_id_base) {
     const auto topic = command_.get("topic");
     const auto producer_count = command_.get<int>("--producers");
-    const auto total_rate = command_.get<int>("--rate");
+    const auto threads_option = command_.get<int>("--threads");
     const auto message_size = command_.get<int>("--message-size");
+    const auto payload_pool_size = command_.get<int>("--payload-pool-size");
+    const auto batch_size = command_.get<int>("--batch-size");
+    const auto burst = command_.get<int>("--burst");
+    const auto spin_us = command_.get<int>("--spin-us");
+    const auto event_poll = command_.get<bool>("--event-poll");
     const auto report_interval_ms = command_.get<int>("--report-interval-ms");
+    const auto transactional = command_.get<bool>("--transactional");
+    const auto txn_size = command_.get<int>("--txn-size");
+    const auto client_stats_enabled = command_.get<bool>("--client-stats");
+    const auto metrics_file = command_.present("--metrics-file");
+    const auto metrics_format =
+        MetricsEmitter::parse_format(command_.get("--metrics-format"));
 
     if (producer_count <= 0) {
       throw std::invalid_argument(
           "The number of producers must be greater than 0");
     }
-    if (total_rate <= 0) {
-      throw std::invalid_argument("The produce rate must be greater than 0");
+    if (threads_option < 0) {
+      throw std::invalid_argument("The number of threads must not be negative");
     }
+    auto search = make_saturation_search();
+    const auto rate_profile = search.has_value()
+                                  ? RateProfile::adaptive(search->rate())
+                                  : make_rate_profile();
+    const auto key_generator = make_key_generator();
     if (message_size <= 0) {
       throw std::invalid_argument(
           "The message size must be greater than 0 bytes");
     }
+    {
+      // A truncated header is ignored by `consume`, so leave room for 10-digit
+      // sequences and a byte after the header
+      MessageHeader::Buffer header;
+      const auto header_size = MessageHeader::format(
+          header, producer_count - 1, 9999999999, MessageHeader::now_us());
+      if (static_cast<size_t>(message_size) <= header_size) {
+        throw std::invalid_argument("The message size must be at least " +
+                                    std::to_string(header_size + 1) +
+                                    " bytes to hold the message header");
+      }
+    }
+    if (payload_pool_size <= 0) {
+      throw std::invalid_argument(
+          "The payload pool size must be greater than 0");
+    }
+    if (batch_size < 0) {
+      throw std::invalid_argument("The batch size must not be negative");
+    }
+    if (burst < 0) {
+      throw std::invalid_argument("The burst must not be negative");
+    }
+    if (spin_us < 0) {
+      throw std::invalid_argument("The spin time must not be negative");
+    }
+    if (transactional && txn_size <= 0) {
+      throw std::invalid_argument(
+          "The transaction size must be greater than 0");
+    }
     if (report_interval_ms <= 0) {
       throw std::invalid_argument(
           "The report interval must be greater than 0 milliseconds");
     }
 
-    std::vector<int> producer_rates(producer_count,
-                                    total_rate / producer_count);
-    for (int i = 0; i < total_rate % producer_count; i++) {
-      producer_rates[i]++;
+    const auto thread_count = threads_option == 0
+                                  ? producer_count
+                                  : std::min(threads_option, producer_count);
+    ProducerOptions options;
+    options.topic = topic;
+    options.message_size = static_cast<size_t>(message_size);
+    options.payload_pool_size = static_cast<size_t>(payload_pool_size);
+    options.batch_size = static_cast<size_t>(batch_size);
+    options.burst = burst;
+    options.payload_content = make_payload_content();
+    options.txn_size = transactional ? static_cast<size_t>(txn_size) : 0;
+    auto producer_configs = base_configs;
+    if (const auto compression = command_.present("--compression")) {
+      producer_configs["compression.codec"] = *compression;
+    }
+    std::optional<ClientStats> client_stats;
+    if (client_stats_enabled) {
+      producer_configs["statistics.interval.ms"] =
+          std::to_string(report_interval_ms);
+      client_stats.emplace(ClientStats::Role::Producer,
+                           static_cast<size_t>(producer_count), topic);
+    }
+    // Validated once here, instead of by each of the producers
+    const KafkaConfTemplate conf_template(producer_configs);
+    {
+      // Partitions created after the start are not counted
+      KafkaClient metadata_client(
+          RD_KAFKA_PRODUCER, conf_template,
+          {{"client.id", make_client_id(client_id_base, "metadata")}},
+          log_configs);
+      options.partitions = static_cast<size_t>(
+          partition_count(metadata_client.rk(), topic, 10000));
     }
+    std::optional<MetricsEmitter> metrics;
+    if (metrics_file.has_value()) {
+      metrics.emplace(*metrics_file, metrics_format, "produce", topic);
+    }
+    const auto producer_rate_profile =
+        rate_profile.scaled(1.0 / producer_count);
+    const auto spin = std::chrono::microseconds(spin_us);
 
-    logging::out() << "Started " << producer_count << " producer"
-                   << (producer_count == 1 ? "" : "s") << " on topic \""
-                   << topic << "\" with total rate " << total_rate
-                   << " msg/s. Press Ctrl+C to stop.";
+    {
+      auto line = logging::out();
+      line << "Started " << producer_count << " producer"
+           << (producer_count == 1 ? "" : "s");
+      if (thread_count != producer_count) {
+        line << " driven by " << thread_count << " thread"
+             << (thread_count == 1 ? "" : "s");
+      }
+      line << " on topic \"" << topic << "\" with total rate "
+           << rate_profile.describe() << ". Press Ctrl+C to stop.";
+    }
 
     StopSignalGuard stop_signal_guard;
-    std::atomic<uint64_t> enqueued_messages = 0;
-    std::atomic<uint64_t> enqueue_failures = 0;
-    std::atomic<uint64_t> completed_messages = 0;
-    std::atomic<uint64_t> delivered_messages = 0;
-    std::atomic<uint64_t> delivery_failures = 0;
+    ProduceCounters counters(static_cast<size_t>(thread_count));
     std::vector<std::thread> threads;
     std::mutex errors_mu;
     std::vector<std::string> errors;
-
+    std::mutex partition_counts_mu;
+    std::vector<uint64_t> partition_counts(options.partitions, 0);
+    // Delivery latency is only recorded by a search, one recorder per thread
+    std::vector<std::unique_ptr<LatencyRecorder>> delivery_latency_recorders;
+    if (search.has_value()) {
+      for (int i = 0; i < thread_count; i++) {
+        delivery_latency_recorders.emplace_back(
+            std::make_unique<LatencyRecorder>());
+      }
+    }
+    // Commit latency is only recorded in transactional mode
+    std::vector<std::unique_ptr<LatencyRecorder>> commit_latency_recorders;
+    if (transactional) {
+      for (int i = 0; i < thread_count; i++) {
+        commit_latency_recorders.emplace_back(
+            std::make_unique<LatencyRecorder>());
+      }
+    }
     auto add_error = [&errors_mu, &errors](std::string message) {
       std::lock_guard<std::mutex> lock(errors_mu);
       errors.emplace_back(std::move(message));
     };
 
-    threads.reserve(producer_count);
-    for (int i = 0; i < producer_count; i++) {
-      threads.emplace_back([&, producer_index = i,
-                            producer_rate = producer_rates[i]]() {
+    threads.reserve(thread_count);
+    for (int i = 0; i < thread_count; i++) {
+      threads.emplace_back([&, thread_index = i]() {
+        auto producer_index = thread_index;
         try {
-          auto client_configs = base_configs;
-          client_configs["client.id"] =
-              make_client_id(client_id_base, producer_index);
-          KafkaClient client(
-              RD_KAFKA_PRODUCER, client_configs, log_configs, false, {},
-              [&completed_messages, &delivered_messages,
-               &delivery_failures](const rd_kafka_message_t *message) {
-                completed_messages++;
-                if (message->err == RD_KAFKA_RESP_ERR_NO_ERROR) {
-                  delivered_messages++;
-                } else {
-                  delivery_failures++;
-                }
-              });
-          const auto start = std::chrono::steady_clock::now();
-          uint64_t sequence = 0;
+          std::vector<std::unique_ptr<Producer>> producers;
+          for (; producer_index < producer_count;
+               producer_index += thread_count) {
+            KafkaConfTemplate::Properties client_configs{
+                {"client.id", make_client_id(client_id_base,
+                                             std::to_string(producer_index))}};
+            if (transactional) {
+              // Stable across runs, so that a restarted producer fences its
+              // previous incarnation
+              client_configs["transactional.id"] = client_configs["client.id"];
+            }
+            producers.emplace_back(std::make_unique<Producer>(
+                producer_index, conf_template, client_configs, log_configs,
+                options, producer_rate_profile,
+                key_generator.with_seed(producer_index + 1),
+                counters.shard(thread_index),
+                delivery_latency_recorders.empty()
+                    ? nullptr
+                    : delivery_latency_recorders[thread_index].get(),
+                commit_latency_recorders.empty()
+                    ? nullptr
+                    : commit_latency_recorders[thread_index].get(),
+                client_stats.has_value() ? &*client_stats : nullptr));
+          }
+
+          // With --event-poll, a producer is only polled when its delivery
+          // report fd is readable, which also ends the wait early
+          std::optional<QueueEventWaiter> waiter;
+          if (event_poll) {
+            waiter.emplace();
+            for (size_t j = 0; j < producers.size(); j++) {
+              waiter->add(producers[j]->enable_delivery_events(), j);
+            }
+          }
 
           while (!StopSignalGuard::is_stop_requested()) {
-            const auto now = std::chrono::steady_clock::now();
-            const auto elapsed = std::chrono::duration<double>(now - start);
-            const auto target_messages = static_cast<uint64_t>(
-                elapsed.count() * static_cast<double>(producer_rate));
-
-            while (sequence < target_messages &&
-                   !StopSignalGuard::is_stop_requested()) {
-              auto key = make_key(producer_index, sequence);
-              auto payload =
-                  make_payload(producer_index, sequence, message_size);
-              const auto err = rd_kafka_producev(
-                  client.rk(), RD_KAFKA_V_TOPIC(topic.c_str()),
-                  RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
-                  RD_KAFKA_V_KEY(key.data(), key.size()),
-                  RD_KAFKA_V_VALUE(payload.data(), payload.size()),
-                  RD_KAFKA_V_END);
-              if (err == RD_KAFKA_RESP_ERR_NO_ERROR) {
-                sequence++;
-                enqueued_messages++;
-                continue;
+            const auto now = Pacer::Clock::now();
+            // Bound the wait so that delivery reports are still served when
+            // the rate is low, or the stop signal is checked in event mode
+            auto deadline = now + (waiter.has_value()
+                                       ? std::chrono::milliseconds(100)
+                                       : std::chrono::milliseconds(10));
+            for (auto &&producer : producers) {
+              producer_index = producer->index();
+              if (producer->send_due_messages()) {
+                deadline = std::min(deadline, producer->next_send_time());
+              } else if (!waiter.has_value()) {
+                // Give the delivery reports some time to free up space
+                deadline = std::min(deadline,
+                                    now + std::chrono::milliseconds(1));
               }
-
-              if (err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
-                rd_kafka_poll(client.rk(), 100);
-                continue;
+              if (!waiter.has_value()) {
+                producer->poll(0);
               }
-
-              enqueue_failures++;
-              throw std::runtime_error("producer[" +
-                                       std::to_string(producer_index) +
-                                       "] failed: " + rd_kafka_err2str(err));
             }
+            if (!waiter.has_value()) {
+              Pacer::sleep_until(deadline, spin);
+              continue;
+            }
+            // Wait for the delivery reports up to the last millisecond before
+            // the deadline, then sleep and spin as usual
+            const auto &ready =
+                waiter->wait(deadline - Pacer::Clock::now() - spin);
+            for (auto j : ready) {
+              producer_index = producers[j]->index();
+              producers[j]->poll(0);
+            }
+            if (ready.empty()) {
+              Pacer::sleep_until(deadline, spin);
+            }
+          }
 
-            rd_kafka_poll(client.rk(), 0);
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          // Flush all producers of this thread within the same 5 seconds
+          const auto flush_deadline =
+              Pacer::Clock::now() + std::chrono::seconds(5);
+          for (auto &&producer : producers) {
+            producer->flush(Pacer::Clock::now());
+          }
+          for (auto &&producer : producers) {
+            producer->flush(flush_deadline);
           }
 
-          rd_kafka_flush(client.rk(), 5000);
+          std::lock_guard<std::mutex> lock(partition_counts_mu);
+          for (auto &&producer : producers) {
+            const auto &counts = producer->partition_counts();
+            for (size_t partition = 0; partition < counts.size();
+                 partition++) {
+              partition_counts[partition] += counts[partition];
+            }
+          }
         } catch (const std::exception &e) {
           logging::err() << "producer[" << producer_index
                          << "] encountered an error: " << e.what();
@@ -185,32 +449,136 @@ public:
     }
 
     const auto report_interval = std::chrono::milliseconds(report_interval_ms);
-    uint64_t previous_enqueued = 0;
-    uint64_t previous_completed = 0;
+    const auto start = std::chrono::steady_clock::now();
+    const auto start_cpu_us = process_cpu_us();
+    auto previous = counters.snapshot();
+    auto previous_cpu_us = start_cpu_us;
+    LatencyHistogram previous_delivery_latency;
+    LatencyHistogram previous_commit_latency;
     while (!StopSignalGuard::is_stop_requested()) {
       std::this_thread::sleep_for(report_interval);
 
-      const auto current_enqueued = enqueued_messages.load();
-      const auto current_enqueue_failures = enqueue_failures.load();
-      const auto current_completed = completed_messages.load();
-      const auto current_delivered = delivered_messages.load();
-      const auto current_delivery_failures = delivery_failures.load();
-      const auto enqueued_delta = current_enqueued - previous_enqueued;
-      const auto completed_delta = current_completed - previous_completed;
+      const auto current = counters.snapshot();
+      const auto current_enqueued =
+          current.total(ProduceCounter::EnqueuedMessages);
+      const auto current_enqueue_failures =
+          current.total(ProduceCounter::EnqueueFailures);
+      const auto current_completed =
+          current.total(ProduceCounter::CompletedMessages);
+      const auto current_delivered =
+          current.total(ProduceCounter::DeliveredMessages);
+      const auto current_delivery_failures =
+          current.total(ProduceCounter::DeliveryFailures);
+      const auto enqueued_delta =
+          current_enqueued - previous.total(ProduceCounter::EnqueuedMessages);
+      const auto completed_delta =
+          current_completed - previous.total(ProduceCounter::CompletedMessages);
       const auto enqueued_rate = static_cast<double>(enqueued_delta) * 1000.0 /
                                  static_cast<double>(report_interval_ms);
       const auto completed_rate = static_cast<double>(completed_delta) *
                                   1000.0 /
                                   static_cast<double>(report_interval_ms);
+      const auto current_cpu_us = process_cpu_us();
+      const auto current_delivery_latency =
+          merge_snapshots(delivery_latency_recorders);
+      const auto interval_delivery_latency =
+          current_delivery_latency.since(previous_delivery_latency);
+      const auto current_commit_latency =
+          merge_snapshots(commit_latency_recorders);
+      const auto interval_commit_latency =
+          current_commit_latency.since(previous_commit_latency);
 
-      logging::out() << "Enqueued " << current_enqueued << " messages ("
-                     << enqueued_rate << " msg/s), completed "
-                     << current_completed << " messages (" << completed_rate
-                     << " msg/s), delivered: " << current_delivered
-                     << ", enqueue failures: " << current_enqueue_failures
-                     << ", delivery failures: " << current_delivery_failures;
-      previous_enqueued = current_enqueued;
-      previous_completed = current_completed;
+      {
+        auto line = logging::out();
+        line << "Enqueued " << current_enqueued << " messages ("
+             << enqueued_rate << " msg/s), completed " << current_completed
+             << " messages (" << completed_rate
+             << " msg/s), delivered: " << current_delivered
+             << ", enqueue failures: " << current_enqueue_failures
+             << ", delivery failures: " << current_delivery_failures;
+        if (enqueued_delta > 0) {
+          line << ", CPU: "
+               << (current_cpu_us - previous_cpu_us) /
+                      static_cast<double>(enqueued_delta)
+               << " us/msg";
+        }
+        if (transactional) {
+          line << ", committed transactions: "
+               << current.total(ProduceCounter::CommittedTransactions)
+               << ", aborted transactions: "
+               << current.total(ProduceCounter::AbortedTransactions);
+          if (interval_commit_latency.count() > 0) {
+            line << ", commit latency "
+                 << interval_commit_latency.format_percentiles();
+          }
+        }
+        if (interval_delivery_latency.count() > 0) {
+          line << ", delivery latency "
+               << interval_delivery_latency.format_percentiles();
+        }
+        if (search.has_value()) {
+          const auto delivered_delta =
+              current_delivered -
+              previous.total(ProduceCounter::DeliveredMessages);
+          const auto probe = search->update(
+              static_cast<double>(delivered_delta) * 1000.0 /
+                  static_cast<double>(report_interval_ms),
+              interval_delivery_latency,
+              current.total(ProduceCounter::QueueFull) -
+                  previous.total(ProduceCounter::QueueFull),
+              current_enqueued - current_completed);
+          line << ", " << search->describe(probe);
+        } else if (!rate_profile.is_constant()) {
+          const auto elapsed = std::chrono::duration<double>(
+              std::chrono::steady_clock::now() - start);
+          line << ", target rate: " << rate_profile.rate_at(elapsed.count())
+               << " msg/s";
+        }
+        if (const auto thread_rates = format_shard_rates(
+                current, previous, ProduceCounter::EnqueuedMessages,
+                report_interval_ms / 1000.0, "producer-thread");
+            !thread_rates.empty()) {
+          line << ", " << thread_rates;
+        }
+      }
+      if (client_stats.has_value()) {
+        client_stats->report();
+      }
+      if (metrics.has_value()) {
+        MetricsEmitter::Sample sample;
+        sample.add_total("enqueued_messages_total", current_enqueued);
+        sample.add_total("completed_messages_total", current_completed);
+        sample.add_total("delivered_messages_total", current_delivered);
+        sample.add_total("enqueue_failures_total", current_enqueue_failures);
+        sample.add_total("delivery_failures_total", current_delivery_failures);
+        sample.add_total("queue_full_total",
+                         current.total(ProduceCounter::QueueFull));
+        sample.add("enqueue_rate", enqueued_rate);
+        sample.add("completed_rate", completed_rate);
+        sample.add("cpu_us_per_msg",
+                   enqueued_delta > 0
+                       ? std::optional<double>(
+                             (current_cpu_us - previous_cpu_us) /
+                             static_cast<double>(enqueued_delta))
+                       : std::nullopt);
+        if (transactional) {
+          sample.add_total(
+              "committed_transactions_total",
+              current.total(ProduceCounter::CommittedTransactions));
+          sample.add_total("aborted_transactions_total",
+                           current.total(ProduceCounter::AbortedTransactions));
+          sample.add_latency("commit_latency", interval_commit_latency);
+        }
+        if (search.has_value()) {
+          sample.add("target_rate", search->rate()->load());
+          sample.add_latency("delivery_latency", interval_delivery_latency);
+        }
+        metrics->emit(std::move(sample));
+      }
+      previous = current;
+      previous_cpu_us = current_cpu_us;
+      previous_delivery_latency = current_delivery_latency;
+      previous_commit_latency = current_commit_latency;
 
       {
         std::lock_guard<std::mutex> lock(errors_mu);
@@ -223,12 +591,65 @@ public:
     for (auto &thread : threads) {
       thread.join();
     }
+    if (metrics.has_value()) {
+      try {
+        metrics->close();
+      } catch (const std::exception &e) {
+        add_error(e.what());
+      }
+    }
+
+    {
+      auto line = logging::out();
+      const auto total = counters.snapshot();
+      const auto total_enqueued = total.total(ProduceCounter::EnqueuedMessages);
+      line << "Stopped producers. Enqueued " << total_enqueued
+           << " messages, completed "
+           << total.total(ProduceCounter::CompletedMessages)
+           << " messages, delivered: "
+           << total.total(ProduceCounter::DeliveredMessages)
+           << ", enqueue failures: "
+           << total.total(ProduceCounter::EnqueueFailures)
+           << ", delivery failures: "
+           << total.total(ProduceCounter::DeliveryFailures);
+      if (total_enqueued > 0) {
+        line << ", CPU: "
+             << (process_cpu_us() - start_cpu_us) /
+                    static_cast<double>(total_enqueued)
+             << " us/msg";
+      }
+    }
 
-    logging::out() << "Stopped producers. Enqueued " << enqueued_messages.load()
-                   << " messages, completed " << completed_messages.load()
-                   << " messages, delivered: " << delivered_messages.load()
-                   << ", enqueue failures: " << enqueue_failures.load()
-                   << ", delivery failures: " << delivery_failures.load();
+    if (transactional) {
+      const auto total = counters.snapshot();
+      auto line = logging::out();
+      line << "Committed "
+           << total.total(ProduceCounter::CommittedTransactions)
+           << " transactions, aborted "
+           << total.total(ProduceCounter::AbortedTransactions);
+      if (const auto latency = merge_snapshots(commit_latency_recorders);
+          latency.count() > 0) {
+        line << ", commit latency " << latency.format_percentiles();
+      }
+    }
+
+    if (search.has_value()) {
+      const auto &search_options = search->options();
+      auto line = logging::out();
+      line << "Highest rate that met the p" << search_options.latency_percentile
+           << " delivery latency target of "
+           << static_cast<double>(search_options.latency_target_us) / 1000.0
+           << " ms: ";
+      if (const auto &best = search->best(); best.has_value()) {
+        line << best->rate << " msg/s (delivered " << best->delivered_rate
+             << " msg/s, p" << search_options.latency_percentile << " "
+             << static_cast<double>(best->latency_us) / 1000.0 << " ms)";
+      } else {
+        line << "none";
+      }
+    }
+
+    report_partition_counts(partition_counts);
 
     if (!errors.empty()) {
       throw std::runtime_error(errors.front());
@@ -240,29 +661,156 @@ private:
 
   static std::string
   make_client_id(const std::optional<std::string> &client_id_base,
-                 int producer_index) {
+                 const std::string &name) {
     if (client_id_base.has_value() && !client_id_base->empty()) {
-      return *client_id_base + "-producer-" + std::to_string(producer_index);
+      return *client_id_base + "-producer-" + name;
     }
-    return "snctl-cpp-producer-" + std::to_string(producer_index);
+    return "snctl-cpp-producer-" + name;
   }
 
-  static std::string make_payload(int producer_index, uint64_t sequence,
-                                  size_t message_size) {
-    std::ostringstream oss;
-    oss << "producer=" << producer_index << " sequence=" << sequence;
-    auto payload = oss.str();
-    if (payload.size() < message_size) {
-      payload.append(message_size - payload.size(), 'x');
-    } else if (payload.size() > message_size) {
-      payload.resize(message_size);
-    }
-    return payload;
+  // CPU time of the whole process, including librdkafka's threads
+  static double process_cpu_us() noexcept {
+    return static_cast<double>(std::clock()) * 1e6 / CLOCKS_PER_SEC;
   }
 
-  static std::string make_key(int producer_index, uint64_t sequence) {
-    std::ostringstream oss;
-    oss << "producer=" << producer_index << " sequence=" << sequence;
-    return oss.str();
+  std::shared_ptr<const PayloadContent> make_payload_content() const {
+    const auto payload = command_.get("--payload");
+    if (payload == "filler") {
+      return nullptr;
+    } else if (payload == "random") {
+      return PayloadContent::random();
+    } else if (payload == "text") {
+      return PayloadContent::text(command_.get<double>("--compressibility"));
+    } else if (payload == "file") {
+      const auto payload_file = command_.present("--payload-file");
+      if (!payload_file) {
+        throw std::invalid_argument(
+            "--payload-file is required by --payload file");
+      }
+      return PayloadContent::corpus(*payload_file);
+    }
+    throw std::invalid_argument("Unknown payload: " + payload);
+  }
+
+  KeyGenerator make_key_generator() const {
+    const auto distribution =
+        KeyGenerator::parse_distribution(command_.get("--key-distribution"));
+    if (distribution == KeyGenerator::Distribution::Unique ||
+        distribution == KeyGenerator::Distribution::None) {
+      return KeyGenerator(distribution, {}, 0);
+    }
+    if (const auto key_file = command_.present("--key-file")) {
+      return KeyGenerator(distribution, KeyGenerator::load_keys(*key_file),
+                          command_.get<double>("--zipf-theta"));
+    }
+    const auto key_count = command_.get<int>("--key-count");
+    if (key_count <= 0) {
+      throw std::invalid_argument("The key count must be greater than 0");
+    }
+    return KeyGenerator(distribution,
+                        KeyGenerator::generate_keys(key_count),
+                        command_.get<double>("--zipf-theta"));
+  }
+
+  // Print the delivered messages of each partition and how skewed they are
+  static void report_partition_counts(const std::vector<uint64_t> &counts) {
+    uint64_t total = 0;
+    uint64_t max_count = 0;
+    for (auto count : counts) {
+      total += count;
+      max_count = std::max(max_count, count);
+    }
+    if (total == 0) {
+      return;
+    }
+
+    const auto mean =
+        static_cast<double>(total) / static_cast<double>(counts.size());
+    logging::out() << "Delivered messages of " << counts.size()
+                   << " partition" << (counts.size() == 1 ? "" : "s")
+                   << " (max/mean: " << static_cast<double>(max_count) / mean
+                   << "):";
+    logging::out() << "| partition | messages | share |";
+    for (size_t partition = 0; partition < counts.size(); partition++) {
+      logging::out() << "| " << partition << " | " << counts[partition]
+                     << " | "
+                     << static_cast<double>(counts[partition]) * 100.0 /
+                            static_cast<double>(total)
+                     << "% |";
+    }
+  }
+
+  std::optional<SaturationSearch> make_saturation_search() const {
+    if (command_.get("--rate-profile") != "search") {
+      return std::nullopt;
+    }
+    const auto rate = command_.present<int>("--rate");
+    if (!rate.has_value() || *rate <= 0) {
+      throw std::invalid_argument("The produce rate must be greater than 0");
+    }
+    const auto latency_target_ms = command_.get<int>("--latency-target-ms");
+    if (latency_target_ms <= 0) {
+      throw std::invalid_argument(
+          "The latency target must be greater than 0 milliseconds");
+    }
+    const auto step = command_.get<int>("--search-step");
+    if (step < 0) {
+      throw std::invalid_argument("The search step must not be negative");
+    }
+
+    SaturationSearch::Options options;
+    options.initial_rate = *rate;
+    options.step = step > 0 ? step : std::max(1.0, *rate * 0.1);
+    options.backoff = command_.get<double>("--search-backoff");
+    options.max_rate = command_.present<int>("--rate-target").value_or(0);
+    options.latency_target_us = static_cast<uint64_t>(latency_target_ms) * 1000;
+    return SaturationSearch(options);
+  }
+
+  RateProfile make_rate_profile() const {
+    const auto shape = command_.get("--rate-profile");
+    if (shape == "csv") {
+      const auto rate_file = command_.present("--rate-file");
+      if (!rate_file.has_value()) {
+        throw std::invalid_argument(
+            "The csv rate profile requires --rate-file");
+      }
+      return RateProfile::load_csv(*rate_file);
+    }
+
+    const auto rate = command_.present<int>("--rate");
+    if (!rate.has_value() || *rate <= 0) {
+      throw std::invalid_argument("The produce rate must be greater than 0");
+    }
+    if (shape == "constant") {
+      return RateProfile::constant(*rate);
+    }
+
+    const auto target = command_.present<int>("--rate-target");
+    const auto period_s = command_.get<int>("--rate-period-s");
+    if (!target.has_value() || *target < 0) {
+      throw std::invalid_argument("The " + shape +
+                                  " rate profile requires a non-negative "
+                                  "--rate-target");
+    }
+    if (period_s <= 0) {
+      throw std::invalid_argument(
+          "The rate period must be greater than 0 seconds");
+    }
+    if (shape == "ramp") {
+      return RateProfile::ramp(*rate, *target, period_s);
+    }
+    if (shape == "step") {
+      const auto steps = command_.get<int>("--rate-steps");
+      if (steps <= 0) {
+        throw std::invalid_argument(
+            "The number of rate steps must be greater than 0");
+      }
+      return RateProfile::step(*rate, *target, steps, period_s);
+    }
+    if (shape == "sine") {
+      return RateProfile::sine(*rate, *target, period_s);
+    }
+    throw std::invalid_argument("Unknown rate profile: " + shape);
   }
 };
@@ -0,0 +1,113 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/message_header.h"
+#include "snctl-cpp/produce/key_generator.h"
+#include "snctl-cpp/produce/payload_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <librdkafka/rdkafka.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Enqueue messages with rd_kafka_produce_batch() on a cached topic handle, so
+// that librdkafka's queue lock is taken once per batch instead of once per
+// message.
+class BatchProducer final {
+public:
+  struct Result {
+    // Number of sequences used by the batch, which excludes the trailing
+    // messages rejected because the queue is full
+    uint64_t sequences = 0;
+    uint64_t enqueued = 0;
+    // Messages rejected for reasons other than a full queue
+    uint64_t failed = 0;
+    // The queue or the payload pool is full
+    bool queue_full = false;
+  };
+
+  BatchProducer(rd_kafka_t *rk, const std::string &topic, size_t batch_size)
+      : rkt_(rd_kafka_topic_new(rk, topic.c_str(), nullptr),
+             &rd_kafka_topic_destroy),
+        messages_(batch_size), keys_(batch_size) {
+    if (!rkt_) {
+      throw std::runtime_error("Failed to create topic handle for " + topic +
+                               ": " + rd_kafka_err2str(rd_kafka_last_error()));
+    }
+  }
+
+  size_t batch_size() const noexcept { return messages_.size(); }
+
+  // Enqueue up to `count` messages whose sequences start from `sequence`. The
+  // batch is cut short when the payload pool runs out of buffers.
+  Result produce(PayloadPool &pool, KeyGenerator &key_generator,
+                 int producer_index, uint64_t sequence, uint64_t count) {
+    const auto limit =
+        static_cast<size_t>(std::min<uint64_t>(count, messages_.size()));
+    size_t size = 0;
+    for (; size < limit; size++) {
+      auto *payload = pool.acquire(producer_index, sequence + size);
+      if (payload == nullptr) {
+        break;
+      }
+      auto &message = messages_[size];
+      message = rd_kafka_message_t{};
+      message.payload = payload;
+      message.len = pool.message_size();
+      const auto key =
+          key_generator.next(producer_index, sequence + size, keys_[size]);
+      message.key = const_cast<char *>(key.data());
+      message.key_len = key.size();
+    }
+
+    Result result;
+    if (size == 0) {
+      result.queue_full = true;
+      return result;
+    }
+
+    // Neither RD_KAFKA_MSG_F_COPY nor RD_KAFKA_MSG_F_FREE: the payloads are
+    // owned by the pool, while the keys are always copied
+    rd_kafka_produce_batch(rkt_.get(), RD_KAFKA_PARTITION_UA, 0,
+                           messages_.data(), static_cast<int>(size));
+    for (size_t i = 0; i < size; i++) {
+      const auto &message = messages_[i];
+      if (message.err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+        result.sequences = i + 1;
+        result.enqueued++;
+        continue;
+      }
+      pool.release(message.payload);
+      if (message.err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+        result.queue_full = true;
+      } else {
+        result.sequences = i + 1;
+        result.failed++;
+      }
+    }
+    return result;
+  }
+
+private:
+  std::unique_ptr<rd_kafka_topic_t, decltype(&rd_kafka_topic_destroy)> rkt_;
+  std::vector<rd_kafka_message_t> messages_;
+  std::vector<MessageHeader::Buffer> keys_;
+};
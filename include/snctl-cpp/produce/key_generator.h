@@ -0,0 +1,161 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/message_header.h"
+#include "snctl-cpp/produce/random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Choose the key of each produced message. Except for the unique keys, all keys
+// come from a precomputed table, so no key is formatted per message.
+class KeyGenerator final {
+public:
+  enum class Distribution { Unique, None, Uniform, Zipfian, Sequential };
+
+  static Distribution parse_distribution(const std::string &name) {
+    if (name == "unique") {
+      return Distribution::Unique;
+    } else if (name == "none") {
+      return Distribution::None;
+    } else if (name == "uniform") {
+      return Distribution::Uniform;
+    } else if (name == "zipfian") {
+      return Distribution::Zipfian;
+    } else if (name == "sequential") {
+      return Distribution::Sequential;
+    }
+    throw std::invalid_argument("Unknown key distribution: " + name);
+  }
+
+  // "key-0", "key-1", ..., "key-<count - 1>"
+  static std::vector<std::string> generate_keys(size_t count) {
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      keys.emplace_back("key-" + std::to_string(i));
+    }
+    return keys;
+  }
+
+  // One key per line, empty lines are ignored
+  static std::vector<std::string> load_keys(const std::string &path) {
+    std::ifstream input(path);
+    if (!input.is_open()) {
+      throw std::runtime_error("Failed to open key file: " + path);
+    }
+    std::vector<std::string> keys;
+    std::string line;
+    while (std::getline(input, line)) {
+      if (!line.empty()) {
+        keys.emplace_back(std::move(line));
+      }
+    }
+    if (keys.empty()) {
+      throw std::invalid_argument("No key found in " + path);
+    }
+    return keys;
+  }
+
+  // `keys` is ignored by the unique and none distributions, `theta` is only
+  // used by the zipfian distribution
+  KeyGenerator(Distribution distribution, std::vector<std::string> keys,
+               double theta)
+      : distribution_(distribution),
+        keys_(std::make_shared<const std::vector<std::string>>(
+            std::move(keys))) {
+    if (distribution_ == Distribution::Unique ||
+        distribution_ == Distribution::None) {
+      return;
+    }
+    if (keys_->empty()) {
+      throw std::invalid_argument("The key table must not be empty");
+    }
+    if (distribution_ == Distribution::Zipfian) {
+      if (theta <= 0) {
+        throw std::invalid_argument("The zipfian theta must be positive");
+      }
+      zipfian_cdf_ = make_zipfian_cdf(keys_->size(), theta);
+    }
+  }
+
+  // Return a generator that shares the key table, with its own random state
+  KeyGenerator with_seed(uint64_t seed) const {
+    auto generator = *this;
+    generator.random_state_ = seed;
+    return generator;
+  }
+
+  Distribution distribution() const noexcept { return distribution_; }
+
+  // Return the key of the message, which may point into `buffer`
+  std::string_view next(int producer_index, uint64_t sequence,
+                        MessageHeader::Buffer &buffer) noexcept {
+    switch (distribution_) {
+    case Distribution::Unique:
+      return {buffer.data(),
+              MessageHeader::format(buffer, producer_index, sequence)};
+    case Distribution::None:
+      return {};
+    case Distribution::Uniform:
+      return (*keys_)[splitmix64(random_state_) % keys_->size()];
+    case Distribution::Zipfian: {
+      const auto u =
+          static_cast<double>(splitmix64(random_state_) >> 11) * 0x1.0p-53;
+      const auto it = std::upper_bound(zipfian_cdf_->cbegin(),
+                                       zipfian_cdf_->cend(), u);
+      const auto rank = std::min<size_t>(
+          static_cast<size_t>(it - zipfian_cdf_->cbegin()),
+          keys_->size() - 1);
+      return (*keys_)[rank];
+    }
+    case Distribution::Sequential:
+      return (*keys_)[sequence % keys_->size()];
+    }
+    return {};
+  }
+
+private:
+  Distribution distribution_;
+  std::shared_ptr<const std::vector<std::string>> keys_;
+  // The cumulative probability of each rank, where rank 0 is the hottest key
+  std::shared_ptr<const std::vector<double>> zipfian_cdf_;
+  uint64_t random_state_ = 0x9e3779b97f4a7c15;
+
+  static std::shared_ptr<const std::vector<double>>
+  make_zipfian_cdf(size_t count, double theta) {
+    std::vector<double> cdf(count);
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+      sum += 1.0 / std::pow(static_cast<double>(i + 1), theta);
+      cdf[i] = sum;
+    }
+    for (auto &value : cdf) {
+      value /= sum;
+    }
+    return std::make_shared<const std::vector<double>>(std::move(cdf));
+  }
+};
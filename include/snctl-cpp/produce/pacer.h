@@ -0,0 +1,104 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/produce/rate_profile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+// A token bucket whose refill rate follows a RateProfile. Tokens accumulate up
+// to the burst size, so a sender that keeps up sends each message at its
+// scheduled time, while a sender that falls behind catches up with at most
+// `burst` messages back-to-back.
+class Pacer final {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // A `burst` of 0 allows 10 ms worth of messages at the current rate
+  Pacer(RateProfile profile, double burst)
+      : profile_(std::move(profile)), burst_(burst), start_(Clock::now()),
+        last_refill_(start_) {}
+
+  // Refill the bucket and return the number of messages that can be sent now
+  uint64_t available() {
+    refill(Clock::now());
+    return static_cast<uint64_t>(tokens_);
+  }
+
+  void consume(uint64_t messages = 1) noexcept {
+    tokens_ -= static_cast<double>(messages);
+  }
+
+  // Return when `tokens` tokens (capped by the burst size) will be available,
+  // or Clock::time_point::max() if the current rate is 0
+  Clock::time_point next_send_time(double tokens = 1) {
+    const auto now = Clock::now();
+    refill(now);
+    tokens = std::min(tokens, capacity());
+    if (tokens_ >= tokens) {
+      return now;
+    }
+    if (rate_ <= 0) {
+      return Clock::time_point::max();
+    }
+    return now + std::chrono::duration_cast<Clock::duration>(
+                     std::chrono::duration<double>((tokens - tokens_) / rate_));
+  }
+
+  // Sleep until `spin` before the deadline, then busy-spin to the deadline
+  static void sleep_until(Clock::time_point deadline,
+                          std::chrono::microseconds spin) {
+    const auto now = Clock::now();
+    if (deadline - now > spin) {
+      std::this_thread::sleep_for(deadline - now - spin);
+    }
+    while (Clock::now() < deadline) {
+      // spin for the sub-scheduler-tick remainder
+    }
+  }
+
+  // The rate of the last refill in messages per second
+  double current_rate() const noexcept { return rate_; }
+
+private:
+  const RateProfile profile_;
+  const double burst_;
+  const Clock::time_point start_;
+  Clock::time_point last_refill_;
+  double rate_ = 0;
+  // Start with a token so that the first message is sent immediately
+  double tokens_ = 1;
+
+  void refill(Clock::time_point now) noexcept {
+    rate_ =
+        profile_.rate_at(std::chrono::duration<double>(now - start_).count());
+    const auto elapsed = std::chrono::duration<double>(now - last_refill_);
+    last_refill_ = now;
+    // Keep the progress towards the token after the last whole one, otherwise
+    // every late wakeup would lose a fraction of a message
+    tokens_ = std::min(std::nextafter(capacity() + 1, 0.0),
+                       tokens_ + rate_ * elapsed.count());
+  }
+
+  double capacity() const noexcept {
+    return burst_ > 0 ? burst_ : std::max(1.0, std::floor(rate_ * 0.01));
+  }
+};
@@ -0,0 +1,162 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/produce/random.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// A read-only block of bytes that payloads are sliced from, so that compression
+// codecs see data that compresses like real traffic instead of a single
+// repeated letter. The block is shared by all producers, each of which copies
+// consecutive slices from its own cursor.
+class PayloadContent final {
+public:
+  // Large enough that consecutive messages of a broker batch don't repeat
+  // within the window of any compression codec
+  static constexpr size_t generated_size = 16 * 1024 * 1024;
+
+  // Incompressible random bytes
+  static std::shared_ptr<const PayloadContent> random() {
+    auto content = std::shared_ptr<PayloadContent>(new PayloadContent());
+    content->generated_.resize(generated_size);
+    uint64_t state = 0x9e3779b97f4a7c15;
+    for (size_t i = 0; i < generated_size; i += sizeof(uint64_t)) {
+      const auto value = splitmix64(state);
+      std::memcpy(content->generated_.data() + i, &value,
+                  std::min(sizeof(value), generated_size - i));
+    }
+    content->data_ = content->generated_.data();
+    content->size_ = content->generated_.size();
+    return content;
+  }
+
+  // Printable text that compresses by roughly `ratio` with zstd and gzip, and
+  // somewhat less with lz4 and snappy, which have no entropy coding: a 1/ratio
+  // fraction of it is fresh random text, while the rest repeats earlier text
+  // within a 32 KiB window.
+  static std::shared_ptr<const PayloadContent> text(double ratio) {
+    if (ratio < 1) {
+      throw std::invalid_argument(
+          "The compressibility ratio must not be less than 1");
+    }
+    static constexpr char alphabet[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ,.";
+    static constexpr size_t segment_size = 64;
+    static constexpr size_t window_size = 32 * 1024;
+
+    auto content = std::shared_ptr<PayloadContent>(new PayloadContent());
+    auto &text = content->generated_;
+    text.resize(generated_size);
+    uint64_t state = 0x2545f4914f6cdd1d;
+    const auto literal_fraction = 1 / ratio;
+    // Consecutive repeated segments keep the same distance, so that they form
+    // one long match instead of many short ones
+    size_t distance = 0;
+    for (size_t i = 0; i < generated_size; i += segment_size) {
+      const auto length = std::min(segment_size, generated_size - i);
+      if (i < window_size || next_unit(state) < literal_fraction) {
+        for (size_t j = 0; j < length; j++) {
+          text[i + j] = alphabet[splitmix64(state) % (sizeof(alphabet) - 1)];
+        }
+        distance = 0;
+      } else {
+        if (distance == 0) {
+          distance = segment_size +
+                     splitmix64(state) % (window_size - segment_size);
+        }
+        std::memcpy(text.data() + i, text.data() + i - distance, length);
+      }
+    }
+    content->data_ = text.data();
+    content->size_ = text.size();
+    return content;
+  }
+
+  // Memory-map the file, e.g. a dump of real JSON or Avro records
+  static std::shared_ptr<const PayloadContent> corpus(const std::string &path) {
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open payload file: " + path);
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+      ::close(fd);
+      throw std::runtime_error("Failed to read non-empty payload file: " +
+                               path);
+    }
+    auto *data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                        MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      throw std::runtime_error("Failed to map payload file: " + path);
+    }
+
+    auto content = std::shared_ptr<PayloadContent>(new PayloadContent());
+    content->data_ = static_cast<const char *>(data);
+    content->size_ = static_cast<size_t>(st.st_size);
+    content->mapped_ = true;
+    return content;
+  }
+
+  PayloadContent(const PayloadContent &) = delete;
+  PayloadContent &operator=(const PayloadContent &) = delete;
+
+  ~PayloadContent() {
+    if (mapped_) {
+      ::munmap(const_cast<char *>(data_), size_);
+    }
+  }
+
+  size_t size() const noexcept { return size_; }
+
+  // Copy the `size` bytes from `cursor` into `dst`, wrapping around at the
+  // end, and advance the cursor
+  void copy(char *dst, size_t size, size_t &cursor) const noexcept {
+    while (size > 0) {
+      cursor %= size_;
+      const auto length = std::min(size, size_ - cursor);
+      std::memcpy(dst, data_ + cursor, length);
+      dst += length;
+      size -= length;
+      cursor += length;
+    }
+  }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::vector<char> generated_;
+
+  PayloadContent() = default;
+
+  // Uniformly distributed in [0, 1)
+  static double next_unit(uint64_t &state) noexcept {
+    return static_cast<double>(splitmix64(state) >> 11) * 0x1.0p-53;
+  }
+};
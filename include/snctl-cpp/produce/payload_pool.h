@@ -0,0 +1,145 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/message_header.h"
+#include "snctl-cpp/produce/payload_content.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// A bounded set of reusable payload buffers. Each buffer is handed to
+// librdkafka without RD_KAFKA_MSG_F_COPY and must be released back to the pool
+// from the delivery report of its message. Buffers are allocated in chunks when
+// the in-flight messages need more of them, so memory usage follows the actual
+// in-flight count instead of the capacity.
+//
+// The pool is not thread-safe: delivery reports are served by the thread that
+// calls rd_kafka_poll() or rd_kafka_flush(), which must be the same thread that
+// acquires the buffers.
+//
+// Without a content source, every buffer is filled with 'x' once. Otherwise,
+// each acquired buffer is refilled with the next slice of the content, since
+// reusing the same few buffers would let the codec compress a whole batch into
+// back-references.
+class PayloadPool final {
+public:
+  PayloadPool(size_t capacity, size_t message_size,
+              std::shared_ptr<const PayloadContent> content = nullptr,
+              size_t content_offset = 0)
+      : capacity_(capacity), message_size_(message_size),
+        content_(std::move(content)), content_cursor_(content_offset) {
+    if (capacity == 0) {
+      throw std::invalid_argument("The payload pool must not be empty");
+    }
+  }
+
+  PayloadPool(const PayloadPool &) = delete;
+  PayloadPool &operator=(const PayloadPool &) = delete;
+
+  // Take a free buffer and stamp the message header, including the current
+  // time, in place. Return nullptr if all buffers are in flight.
+  char *acquire(int producer_index, uint64_t sequence) noexcept {
+    if (free_slots_.empty() && !grow()) {
+      return nullptr;
+    }
+    const auto slot = free_slots_.back();
+    free_slots_.pop_back();
+
+    auto &buffer = buffers_[slot];
+    if (content_) {
+      content_->copy(buffer.payload, message_size_, content_cursor_);
+      buffer.header_size = 0;
+    }
+    MessageHeader::Buffer header;
+    const auto header_size =
+        std::min(MessageHeader::format(header, producer_index, sequence,
+                                       MessageHeader::now_us()),
+                 message_size_);
+    std::memcpy(buffer.payload, header.data(), header_size);
+    // Terminate the timestamp, which the content could otherwise extend with
+    // digits
+    if (content_ && header_size < message_size_) {
+      buffer.payload[header_size] = ' ';
+    }
+    // Restore the filler bytes if the previous header was longer
+    if (buffer.header_size > header_size) {
+      std::fill(buffer.payload + header_size,
+                buffer.payload + buffer.header_size, 'x');
+    }
+    buffer.header_size = header_size;
+    return buffer.payload;
+  }
+
+  void release(const void *payload) noexcept {
+    size_t slot;
+    std::memcpy(&slot, static_cast<const char *>(payload) - sizeof(slot),
+                sizeof(slot));
+    free_slots_.push_back(slot);
+  }
+
+  size_t message_size() const noexcept { return message_size_; }
+
+private:
+  static constexpr size_t chunk_size = 64;
+
+  struct Buffer {
+    char *payload;
+    size_t header_size;
+  };
+
+  const size_t capacity_;
+  const size_t message_size_;
+  const std::shared_ptr<const PayloadContent> content_;
+  size_t content_cursor_;
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  std::vector<Buffer> buffers_;
+  std::vector<size_t> free_slots_;
+
+  // Allocate a chunk of buffers, each of which is prefixed by its slot so that
+  // release() can find it from the payload pointer
+  bool grow() noexcept {
+    const auto count = std::min(chunk_size, capacity_ - buffers_.size());
+    if (count == 0) {
+      return false;
+    }
+    const auto stride = sizeof(size_t) + message_size_;
+    try {
+      auto chunk = std::make_unique<char[]>(count * stride);
+      std::fill_n(chunk.get(), count * stride, 'x');
+      buffers_.reserve(buffers_.size() + count);
+      free_slots_.reserve(buffers_.size() + count);
+      for (size_t i = 0; i < count; i++) {
+        auto *prefix = chunk.get() + i * stride;
+        const auto slot = buffers_.size();
+        std::memcpy(prefix, &slot, sizeof(slot));
+        buffers_.push_back(Buffer{prefix + sizeof(slot), 0});
+        free_slots_.push_back(slot);
+      }
+      chunks_.emplace_back(std::move(chunk));
+    } catch (const std::bad_alloc &) {
+      return false;
+    }
+    return true;
+  }
+};
@@ -0,0 +1,301 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/client_stats.h"
+#include "snctl-cpp/configs.h"
+#include "snctl-cpp/kafka_client.h"
+#include "snctl-cpp/kafka_conf_template.h"
+#include "snctl-cpp/latency_histogram.h"
+#include "snctl-cpp/message_header.h"
+#include "snctl-cpp/produce/batch_producer.h"
+#include "snctl-cpp/produce/key_generator.h"
+#include "snctl-cpp/produce/pacer.h"
+#include "snctl-cpp/produce/payload_content.h"
+#include "snctl-cpp/produce/payload_pool.h"
+#include "snctl-cpp/produce/rate_profile.h"
+#include "snctl-cpp/produce/transaction.h"
+#include "snctl-cpp/sharded_counters.h"
+#include "snctl-cpp/stop_signal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <librdkafka/rdkafka.h>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class ProduceCounter {
+  EnqueuedMessages,
+  EnqueueFailures,
+  CompletedMessages,
+  DeliveredMessages,
+  DeliveryFailures,
+  // Enqueue attempts rejected because the queue or the payload pool is full
+  QueueFull,
+  CommittedTransactions,
+  AbortedTransactions,
+  Count
+};
+
+// One shard per producer thread
+using ProduceCounters = ShardedCounters<ProduceCounter>;
+
+struct ProducerOptions {
+  std::string topic;
+  size_t message_size = 1024;
+  size_t payload_pool_size = 16384;
+  // nullptr means payloads filled with 'x'
+  std::shared_ptr<const PayloadContent> payload_content;
+  // 0 means one rd_kafka_producev() call per message
+  size_t batch_size = 0;
+  // 0 means 10 ms worth of messages, or a full batch in batch mode
+  int burst = 0;
+  // Messages per transaction, 0 means not transactional
+  size_t txn_size = 0;
+  // The partitions of the topic at the start, whose delivered messages are
+  // counted
+  size_t partitions = 0;
+};
+
+// A producer client instance with its own pacing. It is driven by a single
+// thread, which may drive other instances as well, so it never blocks, except
+// for committing transactions.
+class Producer final {
+public:
+  // `overrides` are the properties of this instance, e.g. client.id
+  Producer(int index, const KafkaConfTemplate &conf_template,
+           const KafkaConfTemplate::Properties &overrides,
+           const LogConfigs &log_configs, const ProducerOptions &options,
+           const RateProfile &rate_profile, KeyGenerator key_generator,
+           ProduceCounters::Shard &counters,
+           LatencyRecorder *delivery_latency = nullptr,
+           LatencyRecorder *commit_latency = nullptr,
+           ClientStats *client_stats = nullptr)
+      : index_(index), options_(options), counters_(counters),
+        delivery_latency_(delivery_latency), commit_latency_(commit_latency),
+        key_generator_(std::move(key_generator)),
+        partition_counts_(options.partitions, 0),
+        // Producers start about 1 MiB apart in the content, so that they don't
+        // send identical payloads
+        payload_pool_(options.payload_pool_size, options.message_size,
+                      options.payload_content,
+                      static_cast<size_t>(index) * 1048573),
+        client_(RD_KAFKA_PRODUCER, conf_template, overrides, log_configs,
+                false, {},
+                [this](const rd_kafka_message_t *message) {
+                  on_delivery(message);
+                },
+                make_stats_callback(client_stats, index)),
+        pacer_(rate_profile,
+               options.burst == 0 && options.batch_size > 0
+                   ? static_cast<double>(options.batch_size)
+                   : options.burst) {
+    if (options.batch_size > 0) {
+      batch_producer_.emplace(client_.rk(), options.topic, options.batch_size);
+    }
+    if (options.txn_size > 0) {
+      transaction_.emplace(client_.rk(), options.txn_size, 30000);
+    }
+  }
+
+  Producer(const Producer &) = delete;
+  Producer &operator=(const Producer &) = delete;
+
+  int index() const noexcept { return index_; }
+
+  // Enqueue the messages that are due. Return false if the producer is blocked
+  // by a full queue or payload pool, so it should wait for delivery reports.
+  bool send_due_messages() {
+    auto available = pacer_.available();
+    while (available > 0 && !StopSignalGuard::is_stop_requested()) {
+      if (batch_producer_.has_value()) {
+        auto count = available;
+        if (transaction_.has_value()) {
+          count = std::min<uint64_t>(count, transaction_->begin());
+        }
+        const auto result = batch_producer_->produce(
+            payload_pool_, key_generator_, index_, sequence_, count);
+        sequence_ += result.sequences;
+        counters_.add(ProduceCounter::EnqueuedMessages, result.enqueued);
+        counters_.add(ProduceCounter::EnqueueFailures, result.failed);
+        pacer_.consume(result.sequences);
+        available -= result.sequences;
+        if (transaction_.has_value() && transaction_->add(result.enqueued)) {
+          commit_transaction(transaction_->timeout_ms());
+        }
+        if (result.queue_full) {
+          counters_.add(ProduceCounter::QueueFull);
+          return false;
+        }
+        continue;
+      }
+
+      if (transaction_.has_value()) {
+        transaction_->begin();
+      }
+      auto *payload = payload_pool_.acquire(index_, sequence_);
+      if (payload == nullptr) {
+        counters_.add(ProduceCounter::QueueFull);
+        return false;
+      }
+
+      // The key is always copied by librdkafka, while the payload is owned by
+      // the pool until its delivery report
+      MessageHeader::Buffer key_buffer;
+      const auto key = key_generator_.next(index_, sequence_, key_buffer);
+      const auto err = rd_kafka_producev(
+          client_.rk(), RD_KAFKA_V_TOPIC(options_.topic.c_str()),
+          RD_KAFKA_V_KEY(key.data(), key.size()),
+          RD_KAFKA_V_VALUE(payload, payload_pool_.message_size()),
+          RD_KAFKA_V_END);
+      if (err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+        sequence_++;
+        counters_.add(ProduceCounter::EnqueuedMessages);
+        pacer_.consume();
+        available--;
+        if (transaction_.has_value() && transaction_->add(1)) {
+          commit_transaction(transaction_->timeout_ms());
+        }
+        continue;
+      }
+
+      payload_pool_.release(payload);
+      if (err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+        counters_.add(ProduceCounter::QueueFull);
+        return false;
+      }
+
+      counters_.add(ProduceCounter::EnqueueFailures);
+      throw std::runtime_error("producer[" + std::to_string(index_) +
+                               "] failed: " + rd_kafka_err2str(err));
+    }
+    return true;
+  }
+
+  // When the next message (or batch) is due
+  Pacer::Clock::time_point next_send_time() {
+    return pacer_.next_send_time(
+        static_cast<double>(std::max<size_t>(options_.batch_size, 1)));
+  }
+
+  // The number of delivered messages of each partition, which must be read by
+  // the thread that drives this producer
+  const std::vector<uint64_t> &partition_counts() const noexcept {
+    return partition_counts_;
+  }
+
+  // Serve delivery reports
+  void poll(int timeout_ms) { client_.poll(timeout_ms); }
+
+  // Return a file descriptor that is readable when there are delivery reports
+  // to serve, see KafkaClient::enable_main_queue_events()
+  int enable_delivery_events() { return client_.enable_main_queue_events(); }
+
+  // Wait for the outstanding messages until the deadline, committing the open
+  // transaction if any. A deadline that has passed only sends the queued
+  // messages without waiting, and leaves the transaction open, because a
+  // commit without time to deliver its messages would just time out.
+  void flush(Pacer::Clock::time_point deadline) {
+    const auto timeout_ms = remaining_ms(deadline);
+    if (timeout_ms > 0 && transaction_.has_value() && transaction_->active()) {
+      commit_transaction(timeout_ms);
+    }
+    rd_kafka_flush(client_.rk(), remaining_ms(deadline));
+  }
+
+private:
+  const int index_;
+  const ProducerOptions &options_;
+  ProduceCounters::Shard &counters_;
+  // Written by the thread that drives this producer, which serves the delivery
+  // reports
+  LatencyRecorder *const delivery_latency_;
+  LatencyRecorder *const commit_latency_;
+  KeyGenerator key_generator_;
+  std::vector<uint64_t> partition_counts_;
+  // The pool must outlive the client, whose pending delivery reports still
+  // reference its buffers
+  PayloadPool payload_pool_;
+  KafkaClient client_;
+  std::optional<BatchProducer> batch_producer_;
+  std::optional<TransactionBatcher> transaction_;
+  Pacer pacer_;
+  uint64_t sequence_ = 0;
+
+  static int remaining_ms(Pacer::Clock::time_point deadline) noexcept {
+    const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Pacer::Clock::now());
+    return static_cast<int>(std::max<int64_t>(0, timeout.count()));
+  }
+
+  static KafkaClient::StatsCallback
+  make_stats_callback(ClientStats *client_stats, int index) {
+    if (client_stats == nullptr) {
+      return {};
+    }
+    return [client_stats, index](const char *json, size_t len) {
+      client_stats->update(static_cast<size_t>(index), json, len);
+    };
+  }
+
+  void commit_transaction(int timeout_ms) {
+    const auto start = Pacer::Clock::now();
+    const auto outcome = transaction_->commit(timeout_ms);
+    if (outcome == TransactionBatcher::Outcome::Aborted) {
+      counters_.add(ProduceCounter::AbortedTransactions);
+      return;
+    }
+    counters_.add(ProduceCounter::CommittedTransactions);
+    if (commit_latency_ != nullptr) {
+      commit_latency_->record(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              Pacer::Clock::now() - start)
+              .count()));
+    }
+  }
+
+  void on_delivery(const rd_kafka_message_t *message) noexcept {
+    // The header is stamped by the pool, so it must be read before the buffer
+    // is released
+    if (delivery_latency_ != nullptr &&
+        message->err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+      if (const auto header = MessageHeader::parse(message->payload,
+                                                   message->len);
+          header.has_value() && header->timestamp_us > 0) {
+        delivery_latency_->record(static_cast<uint64_t>(std::max<int64_t>(
+            0, MessageHeader::now_us() - header->timestamp_us)));
+      }
+    }
+    payload_pool_.release(message->payload);
+    counters_.add(ProduceCounter::CompletedMessages);
+    if (message->err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+      counters_.add(ProduceCounter::DeliveryFailures);
+      return;
+    }
+    counters_.add(ProduceCounter::DeliveredMessages);
+    // Sized up front, so that the callback never allocates
+    if (message->partition >= 0 &&
+        static_cast<size_t>(message->partition) < partition_counts_.size()) {
+      partition_counts_[message->partition]++;
+    }
+  }
+};
@@ -0,0 +1,236 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The target rate (msg/s) as a function of the elapsed time since the start
+class RateProfile final {
+public:
+  enum class Shape { Constant, Ramp, Step, Sine, Timeline, Adaptive };
+
+  static RateProfile constant(double rate) {
+    RateProfile profile(Shape::Constant);
+    profile.from_ = profile.to_ = rate;
+    return profile;
+  }
+
+  // Linearly change from `from` to `to` in `duration_s` seconds, then hold
+  static RateProfile ramp(double from, double to, double duration_s) {
+    RateProfile profile(Shape::Ramp);
+    profile.from_ = from;
+    profile.to_ = to;
+    profile.period_s_ = duration_s;
+    return profile;
+  }
+
+  // Change from `from` to `to` in `steps` equal steps over `duration_s`
+  // seconds, then hold
+  static RateProfile step(double from, double to, int steps,
+                          double duration_s) {
+    RateProfile profile(Shape::Step);
+    profile.from_ = from;
+    profile.to_ = to;
+    profile.steps_ = steps;
+    profile.period_s_ = duration_s;
+    return profile;
+  }
+
+  // Oscillate between `low` and `high` with the given period, starting from
+  // `low`. A period of 86400 seconds models a diurnal traffic pattern.
+  static RateProfile sine(double low, double high, double period_s) {
+    RateProfile profile(Shape::Sine);
+    profile.from_ = low;
+    profile.to_ = high;
+    profile.period_s_ = period_s;
+    return profile;
+  }
+
+  // Interpolate linearly between the (elapsed seconds, rate) points, which
+  // must be sorted by time. The rate holds before the first point and after
+  // the last point.
+  static RateProfile timeline(std::vector<std::pair<double, double>> points) {
+    if (points.empty()) {
+      throw std::invalid_argument("The rate timeline must not be empty");
+    }
+    if (!std::is_sorted(points.cbegin(), points.cend(),
+                        [](const auto &lhs, const auto &rhs) {
+                          return lhs.first < rhs.first;
+                        })) {
+      throw std::invalid_argument("The rate timeline must be sorted by time");
+    }
+    RateProfile profile(Shape::Timeline);
+    profile.points_ = std::move(points);
+    return profile;
+  }
+
+  // Follow a rate that is adjusted while running, e.g. by a SaturationSearch
+  static RateProfile adaptive(std::shared_ptr<const std::atomic<double>> rate) {
+    RateProfile profile(Shape::Adaptive);
+    // The factor applied by scaled()
+    profile.from_ = 1;
+    profile.adaptive_rate_ = std::move(rate);
+    return profile;
+  }
+
+  // Load a timeline from a CSV file whose lines are "<seconds>,<rate>". Empty
+  // lines, lines starting with '#' and a leading header line are ignored.
+  static RateProfile load_csv(const std::string &path) {
+    std::ifstream input(path);
+    if (!input.is_open()) {
+      throw std::runtime_error("Failed to open rate file: " + path);
+    }
+
+    std::vector<std::pair<double, double>> points;
+    std::string line;
+    for (int line_number = 1; std::getline(input, line); line_number++) {
+      if (line.empty() || line.front() == '#') {
+        continue;
+      }
+      const auto comma = line.find(',');
+      char *time_end = nullptr;
+      char *rate_end = nullptr;
+      const auto time = std::strtod(line.c_str(), &time_end);
+      const auto rate = comma == std::string::npos
+                            ? 0.0
+                            : std::strtod(line.c_str() + comma + 1, &rate_end);
+      if (comma == std::string::npos || time_end == line.c_str() ||
+          rate_end == line.c_str() + comma + 1) {
+        if (points.empty() && line_number == 1) {
+          continue; // header
+        }
+        throw std::invalid_argument("Invalid line " +
+                                    std::to_string(line_number) + " in " +
+                                    path + ": " + line);
+      }
+      if (time < 0 || rate < 0) {
+        throw std::invalid_argument("Negative value at line " +
+                                    std::to_string(line_number) + " in " +
+                                    path);
+      }
+      points.emplace_back(time, rate);
+    }
+    return timeline(std::move(points));
+  }
+
+  double rate_at(double elapsed_s) const noexcept {
+    switch (shape_) {
+    case Shape::Constant:
+      return from_;
+    case Shape::Ramp:
+      if (elapsed_s >= period_s_) {
+        return to_;
+      }
+      return from_ + (to_ - from_) * elapsed_s / period_s_;
+    case Shape::Step: {
+      const auto step_s = period_s_ / steps_;
+      const auto current_step =
+          std::min(steps_, static_cast<int>(elapsed_s / step_s));
+      return from_ + (to_ - from_) * current_step / steps_;
+    }
+    case Shape::Sine:
+      return from_ + (to_ - from_) *
+                         (1 - std::cos(2 * pi * elapsed_s / period_s_)) / 2;
+    case Shape::Timeline:
+      return interpolate(elapsed_s);
+    case Shape::Adaptive:
+      return from_ * adaptive_rate_->load(std::memory_order_relaxed);
+    }
+    return from_;
+  }
+
+  // Return the same profile with every rate multiplied by `factor`
+  RateProfile scaled(double factor) const {
+    auto profile = *this;
+    profile.from_ *= factor;
+    profile.to_ *= factor;
+    for (auto &point : profile.points_) {
+      point.second *= factor;
+    }
+    return profile;
+  }
+
+  bool is_constant() const noexcept { return shape_ == Shape::Constant; }
+
+  std::string describe() const {
+    std::ostringstream oss;
+    switch (shape_) {
+    case Shape::Constant:
+      oss << from_ << " msg/s";
+      break;
+    case Shape::Ramp:
+      oss << "ramping from " << from_ << " to " << to_ << " msg/s over "
+          << period_s_ << " s";
+      break;
+    case Shape::Step:
+      oss << "stepping from " << from_ << " to " << to_ << " msg/s in "
+          << steps_ << " steps over " << period_s_ << " s";
+      break;
+    case Shape::Sine:
+      oss << "oscillating between " << from_ << " and " << to_
+          << " msg/s with a period of " << period_s_ << " s";
+      break;
+    case Shape::Timeline:
+      oss << "following a timeline of " << points_.size() << " points over "
+          << points_.back().first << " s";
+      break;
+    case Shape::Adaptive:
+      oss << "adapting from " << rate_at(0) << " msg/s";
+      break;
+    }
+    return oss.str();
+  }
+
+private:
+  static constexpr double pi = 3.14159265358979323846;
+
+  Shape shape_;
+  double from_ = 0;
+  double to_ = 0;
+  double period_s_ = 1;
+  int steps_ = 1;
+  std::vector<std::pair<double, double>> points_;
+  std::shared_ptr<const std::atomic<double>> adaptive_rate_;
+
+  explicit RateProfile(Shape shape) : shape_(shape) {}
+
+  double interpolate(double elapsed_s) const noexcept {
+    auto next = std::upper_bound(
+        points_.cbegin(), points_.cend(), elapsed_s,
+        [](double time, const auto &point) { return time < point.first; });
+    if (next == points_.cbegin()) {
+      return next->second;
+    }
+    if (next == points_.cend()) {
+      return points_.back().second;
+    }
+    const auto &previous = *std::prev(next);
+    const auto span = next->first - previous.first;
+    return previous.second + (next->second - previous.second) *
+                                 (elapsed_s - previous.first) / span;
+  }
+};
@@ -0,0 +1,137 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "snctl-cpp/latency_histogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// Search for the highest total rate that the cluster sustains within a
+// delivery latency target. Each report interval is a probe of the current
+// rate: if it met the target, the rate grows by a fixed step, otherwise it is
+// multiplied by the backoff factor (AIMD), so the rate keeps oscillating just
+// below the saturation point.
+class SaturationSearch final {
+public:
+  struct Options {
+    double initial_rate = 0;
+    // The additive increase in msg/s
+    double step = 0;
+    // The multiplicative decrease
+    double backoff = 0.75;
+    // 0 means unbounded
+    double max_rate = 0;
+    uint64_t latency_target_us = 0;
+    double latency_percentile = 99;
+  };
+
+  struct Probe {
+    double rate = 0;
+    double delivered_rate = 0;
+    uint64_t latency_us = 0;
+    uint64_t queue_full = 0;
+    uint64_t in_flight = 0;
+    bool met = false;
+  };
+
+  explicit SaturationSearch(const Options &options)
+      : options_(options),
+        rate_(std::make_shared<std::atomic<double>>(options.initial_rate)) {
+    if (options.initial_rate <= 0) {
+      throw std::invalid_argument("The initial rate must be greater than 0");
+    }
+    if (options.step <= 0) {
+      throw std::invalid_argument("The search step must be greater than 0");
+    }
+    if (options.backoff <= 0 || options.backoff >= 1) {
+      throw std::invalid_argument(
+          "The search backoff must be between 0 and 1");
+    }
+    if (options.latency_target_us == 0) {
+      throw std::invalid_argument(
+          "The latency target must be greater than 0 milliseconds");
+    }
+  }
+
+  // The total rate to send at, which is read by the producers' pacers
+  std::shared_ptr<const std::atomic<double>> rate() const noexcept {
+    return rate_;
+  }
+
+  // Evaluate the last interval at the current rate and move to the next rate
+  Probe update(double delivered_rate, const LatencyHistogram &latency,
+               uint64_t queue_full, uint64_t in_flight) {
+    Probe probe;
+    probe.rate = rate_->load(std::memory_order_relaxed);
+    probe.delivered_rate = delivered_rate;
+    probe.latency_us = latency.value_at_percentile(options_.latency_percentile);
+    probe.queue_full = queue_full;
+    probe.in_flight = in_flight;
+    // By Little's law, more in-flight messages than the rate times the target
+    // mean the latency target will be missed, even before the slow deliveries
+    // are reported
+    const auto target_s =
+        static_cast<double>(options_.latency_target_us) / 1e6;
+    const auto in_flight_limit = std::max(1.0, probe.rate * target_s);
+    probe.met = latency.count() > 0 &&
+                probe.latency_us <= options_.latency_target_us &&
+                queue_full == 0 &&
+                static_cast<double>(in_flight) <= in_flight_limit &&
+                delivered_rate >= probe.rate * 0.9;
+
+    auto next_rate = probe.met ? probe.rate + options_.step
+                               : probe.rate * options_.backoff;
+    if (options_.max_rate > 0) {
+      next_rate = std::min(next_rate, options_.max_rate);
+    }
+    rate_->store(std::max(1.0, next_rate), std::memory_order_relaxed);
+
+    if (probe.met &&
+        (!best_.has_value() || probe.delivered_rate > best_->delivered_rate)) {
+      best_ = probe;
+    }
+    return probe;
+  }
+
+  // The probe with the highest delivered rate that met the target
+  const std::optional<Probe> &best() const noexcept { return best_; }
+
+  const Options &options() const noexcept { return options_; }
+
+  std::string describe(const Probe &probe) const {
+    std::ostringstream oss;
+    oss << "probe at " << probe.rate << " msg/s: p"
+        << options_.latency_percentile << " delivery latency "
+        << static_cast<double>(probe.latency_us) / 1000.0
+        << " ms, queue full: " << probe.queue_full
+        << ", in-flight: " << probe.in_flight << " ("
+        << (probe.met ? "met" : "missed") << "), next rate "
+        << rate_->load(std::memory_order_relaxed) << " msg/s";
+    return oss.str();
+  }
+
+private:
+  const Options options_;
+  const std::shared_ptr<std::atomic<double>> rate_;
+  std::optional<Probe> best_;
+};
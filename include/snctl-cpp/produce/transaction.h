@@ -0,0 +1,114 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <librdkafka/rdkafka.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// Wrap every `size` messages of a transactional producer into a transaction.
+// The producer must be configured with a `transactional.id`.
+//
+// librdkafka has no asynchronous commit, so committing blocks the calling
+// thread until all messages of the transaction are delivered.
+class TransactionBatcher final {
+public:
+  enum class Outcome { Committed, Aborted };
+
+  TransactionBatcher(rd_kafka_t *rk, size_t size, int timeout_ms)
+      : rk_(rk), size_(size), timeout_ms_(timeout_ms) {
+    if (size == 0) {
+      throw std::invalid_argument(
+          "The transaction size must be greater than 0");
+    }
+    check("initialize transactions",
+          rd_kafka_init_transactions(rk_, timeout_ms_));
+  }
+
+  // Begin a transaction unless one is open, then return how many more messages
+  // fit into it
+  size_t begin() {
+    if (!active_) {
+      check("begin transaction", rd_kafka_begin_transaction(rk_));
+      active_ = true;
+      messages_ = 0;
+    }
+    return size_ - messages_;
+  }
+
+  // Count the messages enqueued in the open transaction, return true if it's
+  // full and should be committed
+  bool add(size_t messages) noexcept {
+    messages_ += messages;
+    return messages_ >= size_;
+  }
+
+  bool active() const noexcept { return active_; }
+
+  // Commit the open transaction, or abort it if the commit failed with an
+  // abortable error
+  Outcome commit(int timeout_ms) {
+    for (int attempt = 0;; attempt++) {
+      Error error(rd_kafka_commit_transaction(rk_, timeout_ms),
+                  &rd_kafka_error_destroy);
+      if (!error) {
+        active_ = false;
+        return Outcome::Committed;
+      }
+      if (rd_kafka_error_is_retriable(error.get()) &&
+          attempt < max_commit_retries) {
+        // A retriable error, e.g. a timeout or a coordinator that is still
+        // loading, rarely clears up immediately
+        std::this_thread::sleep_for(commit_retry_backoff);
+        continue;
+      }
+      if (rd_kafka_error_txn_requires_abort(error.get())) {
+        check("abort transaction", rd_kafka_abort_transaction(rk_, timeout_ms));
+        active_ = false;
+        return Outcome::Aborted;
+      }
+      throw std::runtime_error(std::string("Failed to commit transaction: ") +
+                               rd_kafka_error_string(error.get()));
+    }
+  }
+
+  int timeout_ms() const noexcept { return timeout_ms_; }
+
+private:
+  static constexpr int max_commit_retries = 3;
+  static constexpr std::chrono::milliseconds commit_retry_backoff{100};
+
+  using Error = std::unique_ptr<rd_kafka_error_t,
+                                decltype(&rd_kafka_error_destroy)>;
+
+  rd_kafka_t *const rk_;
+  const size_t size_;
+  const int timeout_ms_;
+  bool active_ = false;
+  size_t messages_ = 0;
+
+  static void check(const char *action, rd_kafka_error_t *raw_error) {
+    Error error(raw_error, &rd_kafka_error_destroy);
+    if (error) {
+      throw std::runtime_error(std::string("Failed to ") + action + ": " +
+                               rd_kafka_error_string(error.get()));
+    }
+  }
+};
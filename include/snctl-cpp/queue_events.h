@@ -0,0 +1,184 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <librdkafka/rdkafka.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
+
+// A file descriptor that librdkafka makes readable when a queue becomes
+// non-empty, see rd_kafka_queue_io_event_enable(). It's an eventfd on Linux and
+// a pipe elsewhere.
+//
+// drain() must be called before the queue is served: librdkafka signals again
+// only after the queue has been served, so an event that arrives in between is
+// served by the same poll.
+class QueueEventFd final {
+public:
+  // Take the ownership of `queue`
+  explicit QueueEventFd(rd_kafka_queue_t *queue) : queue_(queue) {
+#if defined(__linux__)
+    read_fd_ = write_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (read_fd_ < 0) {
+      rd_kafka_queue_destroy(queue_);
+      throw std::runtime_error(std::string("Failed to create eventfd: ") +
+                               std::strerror(errno));
+    }
+    // An eventfd only accepts 8-byte writes
+    static const uint64_t payload = 1;
+#else
+    int fds[2];
+    if (::pipe(fds) != 0) {
+      rd_kafka_queue_destroy(queue_);
+      throw std::runtime_error(std::string("Failed to create pipe: ") +
+                               std::strerror(errno));
+    }
+    read_fd_ = fds[0];
+    write_fd_ = fds[1];
+    for (auto fd : fds) {
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+      ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    static const char payload = 1;
+#endif
+    rd_kafka_queue_io_event_enable(queue_, write_fd_, &payload,
+                                   sizeof(payload));
+  }
+
+  QueueEventFd(const QueueEventFd &) = delete;
+  QueueEventFd &operator=(const QueueEventFd &) = delete;
+
+  ~QueueEventFd() {
+    rd_kafka_queue_io_event_enable(queue_, -1, nullptr, 0);
+    rd_kafka_queue_destroy(queue_);
+    ::close(read_fd_);
+    if (write_fd_ != read_fd_) {
+      ::close(write_fd_);
+    }
+  }
+
+  int fd() const noexcept { return read_fd_; }
+
+  void drain() noexcept {
+    char buffer[64];
+    while (::read(read_fd_, buffer, sizeof(buffer)) > 0) {
+    }
+  }
+
+private:
+  rd_kafka_queue_t *const queue_;
+  int read_fd_ = -1;
+  int write_fd_ = -1;
+};
+
+// Wait for any of a set of file descriptors to become readable: epoll on Linux
+// and poll(2) elsewhere. Each descriptor is registered with a tag, e.g. the
+// index of its client, which is returned when it's readable.
+class QueueEventWaiter final {
+public:
+  QueueEventWaiter() {
+#if defined(__linux__)
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+      throw std::runtime_error(std::string("Failed to create epoll: ") +
+                               std::strerror(errno));
+    }
+#endif
+  }
+
+  QueueEventWaiter(const QueueEventWaiter &) = delete;
+  QueueEventWaiter &operator=(const QueueEventWaiter &) = delete;
+
+  ~QueueEventWaiter() {
+#if defined(__linux__)
+    ::close(epoll_fd_);
+#endif
+  }
+
+  void add(int fd, size_t tag) {
+#if defined(__linux__)
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = tag;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+      throw std::runtime_error(std::string("Failed to add fd to epoll: ") +
+                               std::strerror(errno));
+    }
+    events_.resize(events_.size() + 1);
+#else
+    pollfd entry{};
+    entry.fd = fd;
+    entry.events = POLLIN;
+    poll_fds_.emplace_back(entry);
+    tags_.emplace_back(tag);
+#endif
+  }
+
+  // Wait up to `timeout` (rounded down to milliseconds) and return the tags of
+  // the readable descriptors, which are valid until the next call
+  const std::vector<size_t> &wait(std::chrono::nanoseconds timeout) {
+    ready_.clear();
+    const auto timeout_ms = static_cast<int>(std::max<int64_t>(
+        0, std::chrono::duration_cast<std::chrono::milliseconds>(timeout)
+               .count()));
+#if defined(__linux__)
+    if (events_.empty()) {
+      return ready_;
+    }
+    const auto n = ::epoll_wait(epoll_fd_, events_.data(),
+                                static_cast<int>(events_.size()), timeout_ms);
+    for (int i = 0; i < n; i++) {
+      ready_.emplace_back(static_cast<size_t>(events_[i].data.u64));
+    }
+#else
+    if (::poll(poll_fds_.data(), poll_fds_.size(), timeout_ms) > 0) {
+      for (size_t i = 0; i < poll_fds_.size(); i++) {
+        if (poll_fds_[i].revents != 0) {
+          ready_.emplace_back(tags_[i]);
+        }
+      }
+    }
+#endif
+    // A failed wait, e.g. interrupted by a signal, returns nothing, so the
+    // caller just goes on with its loop
+    return ready_;
+  }
+
+private:
+  std::vector<size_t> ready_;
+#if defined(__linux__)
+  int epoll_fd_ = -1;
+  std::vector<epoll_event> events_;
+#else
+  std::vector<pollfd> poll_fds_;
+  std::vector<size_t> tags_;
+#endif
+};
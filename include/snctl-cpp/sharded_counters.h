@@ -0,0 +1,141 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Statistics counters split into one shard per thread. `Counter` must be an
+// enum whose last enumerator is `Count`.
+//
+// Each shard is written by a single thread only, e.g. a producer thread and the
+// delivery reports served by its rd_kafka_poll() calls, so an increment is a
+// relaxed load and store instead of a locked read-modify-write, and shards are
+// aligned to 128 bytes so that no two threads write the same cache line (or
+// the adjacent line that some CPUs prefetch together with it).
+template <typename Counter> class ShardedCounters final {
+public:
+  static constexpr size_t counter_count = static_cast<size_t>(Counter::Count);
+
+  class alignas(128) Shard final {
+  public:
+    void add(Counter counter, uint64_t delta = 1) noexcept {
+      auto &value = values_[static_cast<size_t>(counter)];
+      value.store(value.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+    }
+
+    uint64_t get(Counter counter) const noexcept {
+      return values_[static_cast<size_t>(counter)].load(
+          std::memory_order_relaxed);
+    }
+
+  private:
+    std::array<std::atomic<uint64_t>, counter_count> values_{};
+  };
+
+  // The counters of all shards at some point in time
+  class Snapshot final {
+  public:
+    uint64_t get(size_t shard, Counter counter) const noexcept {
+      return shards_[shard][static_cast<size_t>(counter)];
+    }
+
+    uint64_t total(Counter counter) const noexcept {
+      uint64_t total = 0;
+      for (auto &&values : shards_) {
+        total += values[static_cast<size_t>(counter)];
+      }
+      return total;
+    }
+
+    size_t size() const noexcept { return shards_.size(); }
+
+  private:
+    friend class ShardedCounters;
+    std::vector<std::array<uint64_t, counter_count>> shards_;
+  };
+
+  explicit ShardedCounters(size_t shards) : shards_(shards) {}
+
+  ShardedCounters(const ShardedCounters &) = delete;
+  ShardedCounters &operator=(const ShardedCounters &) = delete;
+
+  Shard &shard(size_t index) noexcept { return shards_[index]; }
+
+  uint64_t total(Counter counter) const noexcept {
+    uint64_t total = 0;
+    for (auto &&shard : shards_) {
+      total += shard.get(counter);
+    }
+    return total;
+  }
+
+  Snapshot snapshot() const {
+    Snapshot snapshot;
+    snapshot.shards_.resize(shards_.size());
+    for (size_t i = 0; i < shards_.size(); i++) {
+      for (size_t j = 0; j < counter_count; j++) {
+        snapshot.shards_[i][j] = shards_[i].get(static_cast<Counter>(j));
+      }
+    }
+    return snapshot;
+  }
+
+private:
+  std::vector<Shard> shards_;
+};
+
+// Summarize the per-shard rates of `counter` between two snapshots to spot
+// stragglers, e.g. "per-thread min 980 msg/s (producer-thread[3]), max 1020
+// msg/s (producer-thread[0])". Return an empty string if there is only one
+// shard.
+template <typename Counter>
+inline std::string
+format_shard_rates(const typename ShardedCounters<Counter>::Snapshot &current,
+                   const typename ShardedCounters<Counter>::Snapshot &previous,
+                   Counter counter, double interval_s,
+                   const std::string &shard_name) {
+  if (current.size() <= 1 || interval_s <= 0) {
+    return "";
+  }
+  size_t min_shard = 0;
+  size_t max_shard = 0;
+  uint64_t min_delta = UINT64_MAX;
+  uint64_t max_delta = 0;
+  for (size_t i = 0; i < current.size(); i++) {
+    const auto delta = current.get(i, counter) - previous.get(i, counter);
+    if (delta < min_delta) {
+      min_delta = delta;
+      min_shard = i;
+    }
+    if (delta >= max_delta) {
+      max_delta = delta;
+      max_shard = i;
+    }
+  }
+  std::ostringstream oss;
+  oss << "per-thread min " << static_cast<double>(min_delta) / interval_s
+      << " msg/s (" << shard_name << "[" << min_shard << "]), max "
+      << static_cast<double>(max_delta) / interval_s << " msg/s ("
+      << shard_name << "[" << max_shard << "])";
+  return oss.str();
+}
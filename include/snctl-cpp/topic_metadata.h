@@ -0,0 +1,44 @@
+/**
+ * Copyright 2025 Yunze Xu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <librdkafka/rdkafka.h>
+#include <stdexcept>
+#include <string>
+
+// The number of partitions of `topic`, 0 if the topic does not exist
+inline int partition_count(rd_kafka_t *rk, const std::string &topic,
+                           int timeout_ms) {
+  auto *rkt = rd_kafka_topic_new(rk, topic.c_str(), nullptr);
+  if (rkt == nullptr) {
+    throw std::runtime_error("Failed to create topic handle for " + topic +
+                             ": " + rd_kafka_err2str(rd_kafka_last_error()));
+  }
+  const struct rd_kafka_metadata *metadata = nullptr;
+  const auto err = rd_kafka_metadata(rk, 0, rkt, &metadata, timeout_ms);
+  rd_kafka_topic_destroy(rkt);
+  if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+    throw std::runtime_error("Failed to get metadata of " + topic + ": " +
+                             rd_kafka_err2str(err));
+  }
+  const auto count =
+      metadata->topic_cnt > 0 && metadata->topics[0].err ==
+                                     RD_KAFKA_RESP_ERR_NO_ERROR
+          ? metadata->topics[0].partition_cnt
+          : 0;
+  rd_kafka_metadata_destroy(metadata);
+  return count;
+}